@@ -6,33 +6,423 @@
 #include <cassert>
 #include <locale>
 #include <utility>
+#include <numeric>
+#include <queue>
+#include <type_traits>
+#include <fstream>
+#include <iterator>
 
 namespace compadre {
 
-    PreprocessedPortugueseText::PreprocessedPortugueseText(const std::string& text) {
-        m_text = preprocess_portuguese_text(text);
+    PreprocessedPortugueseText::PreprocessedPortugueseText(const std::string& text)
+        : m_symbols(from_preprocessed(preprocess_portuguese_text(text)).m_symbols)
+    {
     }
 
-    const std::array<char, 27> PreprocessedPortugueseText::char_list = {
-        ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 
-        'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 
-        'X', 'Y', 'Z'
-    };
+    auto PreprocessedPortugueseText::from_preprocessed(const std::string& text) -> PreprocessedPortugueseText {
+        auto symbols = PackedSymbolBuffer();
+        symbols.reserve(text.size());
+
+        // Convert in blocks so the ids never take a full copy of the text.
+        auto block = std::array<u8, 256>();
+        for (std::size_t first = 0; first < text.size(); first += block.size()) {
+            auto count = std::min(block.size(), text.size() - first);
+            for (std::size_t i = 0; i < count; i++) {
+                block[i] = symbol_id(text[first + i]);
+            }
+            symbols.append(std::span(block).first(count));
+        }
+
+        return {std::move(symbols)};
+    }
+
+    auto PreprocessedPortugueseText::as_string() const -> std::string {
+        auto text = std::string(m_symbols.size(), ' ');
+        auto block = std::array<u8, 256>();
+
+        for (std::size_t first = 0; first < m_symbols.size(); first += block.size()) {
+            auto count = std::min(block.size(), m_symbols.size() - first);
+            m_symbols.unpack(first, std::span(block).first(count));
+            for (std::size_t i = 0; i < count; i++) {
+                text[first + i] = char_list[block[i]];
+            }
+        }
+
+        return text;
+    }
+
+    void PackedSymbolBuffer::append_group(const u8* symbol_ids) {
+        assert(m_size % group_symbols == 0);
+
+        uint64_t group = 0;
+        for (std::size_t i = 0; i < group_symbols; i++) {
+            group |= uint64_t(symbol_ids[i] & symbol_mask) << (i * bits_per_symbol);
+        }
+
+        // The trailing byte of the buffer becomes the first one of the group.
+        auto byte_index = m_bytes.size() - 1;
+        m_bytes.resize(byte_index + group_bytes + 1);
+        for (std::size_t i = 0; i < group_bytes; i++) {
+            m_bytes[byte_index + i] = u8(group >> (i * 8));
+        }
+        m_size += group_symbols;
+    }
+
+    void PackedSymbolBuffer::unpack_group(std::size_t first, u8* symbol_ids) const {
+        assert(first % group_symbols == 0);
+
+        auto byte_index = first / group_symbols * group_bytes;
+        uint64_t group = 0;
+        for (std::size_t i = 0; i < group_bytes; i++) {
+            group |= uint64_t(m_bytes[byte_index + i]) << (i * 8);
+        }
+
+        for (std::size_t i = 0; i < group_symbols; i++) {
+            symbol_ids[i] = u8(group >> (i * bits_per_symbol)) & symbol_mask;
+        }
+    }
+
+    void BitWriter::reserve_bits(std::size_t bit_count) {
+        // Whole words only, plus the word being filled.
+        auto byte_count = (bit_count + 63) / 64 * sizeof(uint64_t) + sizeof(uint64_t);
+        if (byte_count > m_bytes.size()) {
+            m_bytes.resize(byte_count);
+        }
+    }
+
+    void BitWriter::grow() {
+        m_bytes.resize(std::max(2 * m_bytes.size(), m_byte_count + sizeof(uint64_t)));
+    }
+
+    auto BitWriter::finish() -> std::vector<u8> {
+        auto pending_bytes = (m_bit_count + 7) / 8;
+        auto word = m_accumulator;
+        store_word(word);
+
+        m_bytes.resize(m_byte_count - sizeof(uint64_t) + pending_bytes);
+        m_byte_count = 0;
+        m_accumulator = 0;
+        m_bit_count = 0;
+
+        return std::move(m_bytes);
+    }
+
+    auto BitReader::load_tail() const -> uint64_t {
+        uint64_t chunk = 0;
+        for (std::size_t index = m_byte_index;
+                index < m_bytes.size() && index < m_byte_index + sizeof(chunk);
+                index++)
+        {
+            chunk |= uint64_t(m_bytes[index]) << ((index - m_byte_index) * 8);
+        }
+
+        return chunk;
+    }
+
+    void SymbolHistogram::add(std::span<const u8> symb_ids) {
+        std::size_t index = 0;
+        for (; index + table_count <= symb_ids.size(); index += table_count) {
+            for (std::size_t table = 0; table < table_count; table++) {
+                assert(symb_ids[index + table] < symbol_table_size);
+                m_tables[table][symb_ids[index + table]]++;
+            }
+        }
+
+        for (; index < symb_ids.size(); index++) {
+            assert(symb_ids[index] < symbol_table_size);
+            m_tables[0][symb_ids[index]]++;
+        }
+    }
+
+    auto SymbolHistogram::counts() const -> SymbolCounts {
+        auto counts = m_tables[0];
+        for (std::size_t table = 1; table < table_count; table++) {
+            for (std::size_t symb_id = 0; symb_id < symbol_table_size; symb_id++) {
+                counts[symb_id] += m_tables[table][symb_id];
+            }
+        }
+
+        return counts;
+    }
+
+    auto scaled_counts(const SymbolCounts& counts, uint32_t max_total) -> SymbolCounts {
+        uint64_t total = 0;
+        for (auto count: counts) {
+            total += count;
+        }
+
+        if (total <= max_total) {
+            return counts;
+        }
+
+        auto scaled = SymbolCounts{};
+        for (std::size_t symb_id = 0; symb_id < symbol_table_size; symb_id++) {
+            if (counts[symb_id] > 0) {
+                scaled[symb_id] = std::max(uint32_t(1), uint32_t(uint64_t(counts[symb_id]) * max_total / total));
+            }
+        }
+
+        return scaled;
+    }
+
+    auto quantized_counts(const SymbolCounts& counts, std::size_t total_bits) -> SymbolCounts {
+        uint64_t total = 0;
+        for (auto count: counts) {
+            total += count;
+        }
+
+        auto quantized = SymbolCounts{};
+        if (total == 0) {
+            return quantized;
+        }
+
+        auto target = uint64_t(1) << total_bits;
+        uint64_t quantized_total = 0;
+        for (std::size_t symb_id = 0; symb_id < symbol_table_size; symb_id++) {
+            if (counts[symb_id] > 0) {
+                quantized[symb_id] = std::max(uint32_t(1), uint32_t(uint64_t(counts[symb_id]) * target / total));
+                quantized_total += quantized[symb_id];
+            }
+        }
+
+        // The rounding is settled on the most frequent symbols, where it
+        // costs the least.
+        auto most_frequent = std::ranges::max_element(quantized) - quantized.begin();
+        if (quantized_total < target) {
+            quantized[most_frequent] += uint32_t(target - quantized_total);
+        }
+        while (quantized_total > target) {
+            most_frequent = std::ranges::max_element(quantized) - quantized.begin();
+            assert(quantized[most_frequent] > 1);
+            quantized[most_frequent]--;
+            quantized_total--;
+        }
+
+        return quantized;
+    }
+
+    void CumulativeCounts::halve() {
+        // Back to plain counts in place, undoing the build below from the
+        // last node: a node still holds its sum when it is subtracted
+        // from its parent, as its own children come before it.
+        for (auto node = m_tree.size(); node > 0; node--) {
+            auto parent = node + (node & -node);
+            if (parent <= m_tree.size()) {
+                m_tree[parent - 1] -= m_tree[node - 1];
+            }
+        }
+
+        m_total = 0;
+        for (auto& count: m_tree) {
+            count = (count + 1) / 2;
+            m_total += count;
+        }
+
+        for (std::size_t node = 1; node <= m_tree.size(); node++) {
+            auto parent = node + (node & -node);
+            if (parent <= m_tree.size()) {
+                m_tree[parent - 1] += m_tree[node - 1];
+            }
+        }
+    }
+
+    DecodeTreeCache::DecodeTreeCache(std::size_t index_bits)
+        : m_resource((std::size_t(1) << index_bits) * (symbol_table_size - 1) * sizeof(PackedCodeTree::Node)),
+          m_index_bits(index_bits)
+    {
+        assert(index_bits > 0 && index_bits < 64);
+        m_entries.reserve(std::size_t(1) << index_bits);
+        for (std::size_t index = 0; index < (std::size_t(1) << index_bits); index++) {
+            auto& entry = m_entries.emplace_back(DistributionKey(), false, PackedCodeTree(&m_resource));
+            entry.tree.reserve(symbol_table_size);
+        }
+    }
+
+    ModelSnapshot::ModelSnapshot(std::vector<u8> bytes)
+        : m_bytes(std::move(bytes))
+    {
+    }
+
+    auto ModelSnapshot::load_file(const std::string& path) -> std::optional<ModelSnapshot> {
+        auto file = std::ifstream(path, std::ios::binary);
+        if (not file) {
+            return std::nullopt;
+        }
+
+        auto bytes = std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (file.bad() || bytes.empty()) {
+            return std::nullopt;
+        }
+        return ModelSnapshot(std::move(bytes));
+    }
+
+    auto ModelSnapshot::id() const -> uint32_t {
+        uint32_t hash = 2166136261u;
+        for (auto byte: m_bytes) {
+            hash = (hash ^ byte) * 16777619u;
+        }
+        return hash == 0 ? 1 : hash;
+    }
+
+    auto ModelSnapshot::order() const -> std::optional<std::size_t> {
+        if (m_bytes.size() <= sizeof(magic)) {
+            return std::nullopt;
+        }
+
+        auto inbuff = BitReader(m_bytes);
+        if (inbuff.read<uint32_t>() != magic) {
+            return std::nullopt;
+        }
+        return inbuff.read<uint8_t>();
+    }
+
+    void write_symbol_counts(BitWriter& outbuff, const SymbolCounts& counts, std::span<const u8> symb_ids) {
+        uint32_t max_count = 0;
+        for (auto symb_id: symb_ids) {
+            max_count = std::max(max_count, counts[symb_id]);
+        }
+
+        auto bits_per_count = uint8_t(std::bit_width(max_count));
+        outbuff.write(bits_per_count);
+        for (auto symb_id: symb_ids) {
+            outbuff.write_bits(counts[symb_id], bits_per_count);
+        }
+    }
+
+    auto read_symbol_counts(BitReader& inbuff, std::span<const u8> symb_ids) -> SymbolCounts {
+        auto counts = SymbolCounts{};
+        auto bits_per_count = std::size_t(inbuff.read<uint8_t>());
+        assert(bits_per_count <= 32);
+
+        for (auto symb_id: symb_ids) {
+            counts[symb_id] = uint32_t(inbuff.read_bits(bits_per_count));
+        }
+
+        return counts;
+    }
+
+    PeriodicRebuild::PeriodicRebuild(std::span<const u8> symb_ids, uint32_t period)
+        : m_period(period)
+    {
+        assert(period > 0);
+        for (auto symb_id: symb_ids) {
+            m_counts[symb_id] = 1;
+        }
+        m_total = uint32_t(symb_ids.size());
+    }
+
+    void PeriodicRebuild::rebuilt(const CodeLengths& lengths) {
+        m_coded = 0;
+        m_coded_bits = 0;
+        m_expected_bits = 0;
+        for (std::size_t symb_id = 0; symb_id < symbol_table_size; symb_id++) {
+            m_expected_bits += uint64_t(m_counts[symb_id]) * lengths[symb_id];
+        }
+        m_expected_total = m_total;
+    }
+
+    void PeriodicRebuild::halve_counts() {
+        m_total = 0;
+        for (auto& count: m_counts) {
+            // Symbols that had some count keep at least 1.
+            count = (count + 1) / 2;
+            m_total += count;
+        }
+    }
+
+    void write_code_lengths(BitWriter& outbuff, const CodeLengths& lengths, std::span<const u8> symb_ids) {
+        uint8_t max_length = 0;
+        for (auto symb_id: symb_ids) {
+            max_length = std::max(max_length, lengths[symb_id]);
+        }
+
+        auto bits_per_length = uint8_t(std::bit_width(max_length));
+        outbuff.write(bits_per_length);
+        for (auto symb_id: symb_ids) {
+            outbuff.write_bits(lengths[symb_id], bits_per_length);
+        }
+    }
+
+    auto read_code_lengths(BitReader& inbuff, std::span<const u8> symb_ids) -> std::optional<CodeLengths> {
+        auto lengths = CodeLengths{};
+        auto bits_per_length = std::size_t(inbuff.read<uint8_t>());
+        if (bits_per_length > std::bit_width(CodeWord::max_length)) {
+            return std::nullopt;
+        }
+
+        auto length_counts = std::array<std::size_t, CodeWord::max_length + 1>{};
+        for (auto symb_id: symb_ids) {
+            auto length = inbuff.read_bits(bits_per_length);
+            if (length > CodeWord::max_length) {
+                return std::nullopt;
+            }
+            lengths[symb_id] = uint8_t(length);
+            length_counts[length]++;
+        }
+
+        // Kraft inequality: the codes of each length must fit in what the
+        // shorter ones leave. With symbol_table_size free codes no lengths
+        // can run out, so `free_codes` stops there.
+        std::size_t free_codes = 1;
+        for (std::size_t length = 1; length <= CodeWord::max_length; length++) {
+            free_codes = std::min(2 * free_codes, symbol_table_size);
+            if (length_counts[length] > free_codes) {
+                return std::nullopt;
+            }
+            free_codes -= length_counts[length];
+        }
+
+        return lengths;
+    }
+
+    auto PackedSymbolBuffer::pack(std::span<const u8> symbol_ids) -> PackedSymbolBuffer {
+        auto buffer = PackedSymbolBuffer();
+        buffer.reserve(symbol_ids.size());
+        buffer.append(symbol_ids);
+        return buffer;
+    }
+
+    void PackedSymbolBuffer::append(std::span<const u8> symbol_ids) {
+        std::size_t index = 0;
+
+        // Complete the current group one symbol at a time.
+        while (index < symbol_ids.size() && m_size % group_symbols != 0) {
+            push_back(symbol_ids[index++]);
+        }
+
+        for (; index + group_symbols <= symbol_ids.size(); index += group_symbols) {
+            append_group(&symbol_ids[index]);
+        }
+
+        while (index < symbol_ids.size()) {
+            push_back(symbol_ids[index++]);
+        }
+    }
+
+    void PackedSymbolBuffer::unpack(std::size_t first, std::span<u8> symbol_ids) const {
+        assert(first + symbol_ids.size() <= m_size);
+        std::size_t index = 0;
+
+        while (index < symbol_ids.size() && (first + index) % group_symbols != 0) {
+            symbol_ids[index] = (*this)[first + index];
+            index++;
+        }
+
+        for (; index + group_symbols <= symbol_ids.size(); index += group_symbols) {
+            unpack_group(first + index, &symbol_ids[index]);
+        }
+
+        while (index < symbol_ids.size()) {
+            symbol_ids[index] = (*this)[first + index];
+            index++;
+        }
+    }
     /*
     const std::array<char, 2> PreprocessedPortugueseText::char_list = {
         'A', 'I' 
     };
     */
 
-    std::unordered_map<char, float> PreprocessedPortugueseText::StaticModel::char_frequencies = {
-        {' ', 17.00}, {'E', 14.63}, {'A', 13.72}, {'O', 10.73}, {'S', 7.81},
-        {'R', 6.53},  {'I', 6.18},  {'N', 5.05},  {'D', 4.99},  {'M', 4.74},
-        {'U', 4.63},  {'T', 4.34},  {'C', 3.88},  {'L', 2.78},  {'P', 2.52},
-        {'V', 1.67},  {'G', 1.30},  {'H', 1.28},  {'Q', 1.20},  {'B', 1.04},
-        {'F', 1.02},  {'Z', 0.47},  {'J', 0.40},  {'X', 0.27},  {'K', 0.02},
-        {'W', 0.01},  {'Y', 0.01}
-    };
-
     static std::unordered_map<wchar_t, char> create_accent_map() {
         const std::wstring accented = L"ÀÁÂÃÄÅÆÇÈÉÊËÌÍÎÏÐÑÒÓÔÕÖ×ÙÚÛÜÝÞßàáâãäåæçèéêëìíîïðñòóôõöøùúûüýþÿ";
         const std::string unaccented = "AAAAAAECEEEEIIIIDNOOOOOxUUUUYPsaaaaaaeceeeeiiiiOnooooo0uuuuypy";
@@ -91,6 +481,167 @@ namespace compadre {
         return final_result;
     }
 
+    WordDictionary::WordDictionary(std::vector<std::string> words)
+        : m_words(std::move(words))
+    {
+        assert(m_words.size() <= max_words && "Too many words for the token range.");
+
+        for (auto [word_index, word]: std::views::enumerate(m_words)) {
+            m_index_of[word] = uint8_t(word_index);
+        }
+    }
+
+    auto WordDictionary::portuguese() -> WordDictionary {
+        // Ordenadas por frequencia. Palavras de uma letra nao
+        // encurtam o texto, entao ficam de fora.
+        return WordDictionary({
+            "DE", "QUE", "DO", "DA", "EM", "UM", "PARA", "COM",
+            "NAO", "UMA", "OS", "NO", "SE", "NA", "POR", "MAIS",
+            "AS", "DOS", "COMO", "MAS", "AO", "ELE", "DAS", "SEU",
+            "SUA", "OU", "QUANDO", "MUITO", "NOS", "JA", "EU", "TAMBEM",
+            "SO", "PELO", "PELA", "ATE", "ISSO", "ELA", "ENTRE", "DEPOIS",
+            "SEM", "MESMO", "AOS", "SEUS", "QUEM", "NAS", "ME", "ESSE",
+            "ELES", "ESTA", "VOCE", "ESSA", "NUM", "NEM", "SUAS", "MEU",
+            "MINHA", "NUMA", "PELOS", "ELAS", "QUAL", "LHE", "ERA", "ESTE",
+        });
+    }
+
+    auto WordDictionary::from_text(const std::string& text, std::size_t word_count) -> WordDictionary {
+        assert(word_count <= max_words);
+
+        auto word_occurencies = std::unordered_map<std::string, uint32_t>();
+        std::stringstream ss(text);
+        std::string word;
+        while (ss >> word) {
+            if (word.size() > 1) {
+                word_occurencies[word]++;
+            }
+        }
+
+        // Symbols saved by the token: every occurency shrinks to one symbol.
+        auto ranked = std::vector<std::pair<std::string, uint64_t>>();
+        for (auto& [candidate, occurencies]: word_occurencies) {
+            ranked.emplace_back(candidate, uint64_t(occurencies) * (candidate.size() - 1));
+        }
+
+        std::ranges::sort(ranked,
+            [](const auto& a, const auto& b) {
+                if (a.second != b.second) {
+                    return a.second > b.second;
+                }
+                return a.first < b.first;
+            });
+
+        auto words = std::vector<std::string>();
+        for (auto& [candidate, saved]: ranked) {
+            if (words.size() == word_count) {
+                break;
+            }
+            words.push_back(candidate);
+        }
+
+        return {words};
+    }
+
+    auto WordDictionary::read_from(BitReader& inbuff) -> std::optional<WordDictionary> {
+        auto word_count = inbuff.read<uint8_t>();
+        if (word_count > max_words) {
+            return std::nullopt;
+        }
+        auto words = std::vector<std::string>();
+
+        const auto& char_list = PreprocessedPortugueseText::char_list;
+        for (uint8_t word_index = 0; word_index < word_count; word_index++) {
+            auto word_lenght = inbuff.read<uint8_t>();
+            auto word = std::string();
+            for (uint8_t ch_index = 0; ch_index < word_lenght; ch_index++) {
+                auto ch = char(inbuff.read<uint8_t>());
+                if (std::ranges::find(char_list, ch) == char_list.end()) {
+                    return std::nullopt;
+                }
+                word += ch;
+            }
+            words.push_back(word);
+        }
+
+        return WordDictionary(std::move(words));
+    }
+
+    void WordDictionary::write_to(BitWriter& outbuff) const {
+        outbuff.write(uint8_t(m_words.size()));
+        for (auto& word: m_words) {
+            assert(word.size() <= std::numeric_limits<uint8_t>::max());
+            outbuff.write(uint8_t(word.size()));
+            for (char ch: word) {
+                outbuff.write(uint8_t(ch));
+            }
+        }
+    }
+
+    auto WordDictionary::serialized_size() const -> std::size_t {
+        std::size_t size = sizeof(uint8_t);
+        for (auto& word: m_words) {
+            size += sizeof(uint8_t) + word.size();
+        }
+
+        return size;
+    }
+
+    auto WordDictionary::tokenize(const std::string& text) const -> std::string {
+        auto tokenized = std::string();
+        tokenized.reserve(text.size());
+
+        std::size_t word_begin = 0;
+        while (word_begin <= text.size()) {
+            auto word_end = std::min(text.find(' ', word_begin), text.size());
+            auto word = text.substr(word_begin, word_end - word_begin);
+
+            auto found = m_index_of.find(word);
+            if (found != m_index_of.end()) {
+                tokenized += token_of(found->second);
+            } else {
+                tokenized += word;
+            }
+
+            if (word_end < text.size()) {
+                tokenized += ' ';
+            }
+
+            word_begin = word_end + 1;
+        }
+
+        return tokenized;
+    }
+
+    auto WordDictionary::detokenize(const std::string& tokens) const -> std::string {
+        auto text = std::string();
+        text.reserve(tokens.size() * 2);
+
+        for (char ch: tokens) {
+            if (is_token(ch)) {
+                text += m_words.at(index_of(ch));
+            } else {
+                text += ch;
+            }
+        }
+
+        return text;
+    }
+
+    auto WordDictionary::occurencies_of(char token) const -> uint32_t {
+        assert(index_of(token) < m_words.size());
+        return uint32_t(6000.0 / double(index_of(token) + 1));
+    }
+
+    auto WordDictionary::tokens() const -> std::vector<char> {
+        auto token_list = std::vector<char>();
+        for (std::size_t word_index = 0; word_index < m_words.size(); word_index++) {
+            token_list.push_back(token_of(word_index));
+        }
+
+        return token_list;
+    }
+
     std::pair<SymbolList<SFSymbol>, SymbolList<SFSymbol>> SFTreeNode::slip_symbol_list(SymbolList<SFSymbol>& symb_list) {
         uint32_t total_occurencies = 0;
 
@@ -280,72 +831,154 @@ namespace compadre {
         return code_tree.get_code_map();
     }
 
-    auto Huffman::generate_code_tree(SymbolListType<Huffman>::type& symb_list) -> CodeTree<HuffmanNode> {
+    static auto canonical_tree_nodes(const std::pmr::vector<HuffmanNode>& sorted_leaves, const std::vector<uint8_t>& lengths)
+        -> std::pmr::vector<HuffmanNode>;
+
+    // Huffman::two_queue_merges over the sorted leaves. The nodes are
+    // written straight into their final slots: the internal node
+    // created at step k goes to (n - 2 - k), which leaves the root at
+    // index 0, and the leaves follow them. Both arrays are in the
+    // memory of `leaves`.
+    static auto huffman_tree_nodes(SymbolList<HuffmanSymbol>& symb_list, std::pmr::vector<HuffmanNode>& leaves)
+        -> std::pmr::vector<HuffmanNode>
+    {
         assert(symb_list.size() > 0 && "SymbolList is empty!");
-        /*
-        auto print_root = [](HuffmanNode root) {
-            auto root_symb = root.symbol().has_value()
-                ?
-                root.symbol().value().is_unknown()
-                    ?
-                    std::string("rho")
-                    :
-                    std::string(1, root.symbol().value().inner().value())
-                :
-                "None";
-            std::println("{} {}", root_symb, root.get_content().value());
-        };
-        */
 
-        auto forest = std::vector<CodeTree<HuffmanNode>>();
+        auto leaf_count = symb_list.size();
+        leaves.reserve(leaf_count);
         for (auto& symb: symb_list) {
-            auto root = HuffmanNode(symb.attribute().value(), symb);
-            auto single_node_tree = CodeTree<HuffmanNode>(root); 
-            forest.push_back(single_node_tree);
+            leaves.emplace_back(symb.attribute().value(), symb);
         }
 
-        // Tipos de nos da arvore
-        //  1. Com simbolo
-        //  2. Com simbolo desconhecido (rho)
-        //  3. Sem Simbolo
-        //
+        // Ascending order: the next root to be merged is at the front.
+        std::ranges::sort(leaves, [](const HuffmanNode& a, const HuffmanNode& b) {
+            return HuffmanNode::greater_than(b, a);
+        });
+
+        auto nodes = std::pmr::vector<HuffmanNode>(2 * leaf_count - 1, HuffmanNode(0), leaves.get_allocator());
+        auto first_leaf = leaf_count - 1;
+        for (auto [position, leaf]: std::views::enumerate(leaves)) {
+            auto index = first_leaf + std::size_t(position);
+            nodes[index] = leaf;
+            nodes[index].m_index = index;
+        }
 
-        // Peso de ordenacao (criterio de desempate)
-        //  1. Contador 
-        //  2. ter Simbolo vazio
-        //  3. Ordem dos simbolos (se tem um simbolo)
-        //  4. Nao ter simbolo
+        // Slot of a node numbered as in two_queue_merges: the leaves
+        // forwards from first_leaf, the internal nodes backwards.
+        auto slot_of = [&](std::size_t node) {
+            return node < leaf_count ? first_leaf + node : first_leaf - 1 - (node - leaf_count);
+        };
 
-        while (forest.size() > 1) {
-            std::ranges::sort(
-                forest,
-                CodeTree<HuffmanNode>::greater_than
-            );
+        Huffman::two_queue_merges(leaf_count,
+            [&](std::size_t node) { return nodes[slot_of(node)].get_content().value(); },
+            [&](std::size_t step, std::size_t ultimo, std::size_t penultimo) {
+                auto merged_index = first_leaf - 1 - step;
+                ultimo = slot_of(ultimo);
+                penultimo = slot_of(penultimo);
+
+                auto& merged = nodes[merged_index];
+                merged.set_content(
+                    nodes[penultimo].get_content().value()
+                    + nodes[ultimo].get_content().value()
+                );
+                merged.m_index = merged_index;
+                merged.m_left_index = penultimo;
+                merged.m_right_index = ultimo;
+                nodes[penultimo].m_parent_index = merged_index;
+                nodes[ultimo].m_parent_index = merged_index;
+            });
+
+        return nodes;
+    }
 
+    auto Huffman::generate_code_tree(SymbolListType<Huffman>::type& symb_list) -> CodeTree<HuffmanNode> {
+        auto leaves = std::pmr::vector<HuffmanNode>();
+        auto nodes = huffman_tree_nodes(symb_list, leaves);
+
+        // Parents always sit before their children, so the depths come
+        // out in a single forward pass.
+        auto depth = std::vector<std::size_t>(nodes.size(), 0);
+        std::size_t max_depth = 0;
+        for (std::size_t index = 1; index < nodes.size(); index++) {
+            depth[index] = depth[nodes[index].m_parent_index.value()] + 1;
+            max_depth = std::max(max_depth, depth[index]);
+        }
 
-            /*
-            std::println("Sorted roots:");
-            for (auto& tree: forest) {
-                print_root(tree.root());
+        if (max_depth > max_code_length) {
+            auto weights = std::vector<uint64_t>();
+            weights.reserve(leaves.size());
+            for (auto& leaf: leaves) {
+                weights.push_back(leaf.get_content().value());
             }
-            */
 
-            auto ultimo = forest.back();
-            forest.pop_back();
-            auto penultimo = forest.back();
-            forest.pop_back();
+            auto lengths = limited_code_lengths(weights, max_code_length);
+            nodes = canonical_tree_nodes(leaves, lengths);
+        }
 
+        return CodeTree<HuffmanNode>(std::move(nodes));
+    }
 
-            auto merged = CodeTree<HuffmanNode>::merge(penultimo, ultimo);
+    auto Huffman::generate_code_tree(SymbolListType<Huffman>::type& symb_list, std::pmr::memory_resource* resource)
+        -> CodeTree<HuffmanNode>
+    {
+        auto leaves = std::pmr::vector<HuffmanNode>(resource);
+        return CodeTree<HuffmanNode>(huffman_tree_nodes(symb_list, leaves));
+    }
 
-            forest.push_back(merged);
+    // Tree of the canonical code with the given lengths: shorter codes
+    // first and, within a length, the heavier leaves first. Same layout
+    // of generate_code_tree, root at index 0.
+    static auto canonical_tree_nodes(const std::pmr::vector<HuffmanNode>& sorted_leaves, const std::vector<uint8_t>& lengths)
+        -> std::pmr::vector<HuffmanNode>
+    {
+        auto order = std::vector<std::size_t>(sorted_leaves.size());
+        std::iota(order.begin(), order.end(), std::size_t(0));
+        std::ranges::sort(order, [&](std::size_t a, std::size_t b) {
+            return lengths[a] != lengths[b] ? lengths[a] < lengths[b] : a > b;
+        });
+
+        auto nodes = std::pmr::vector<HuffmanNode>({HuffmanNode(0)}, sorted_leaves.get_allocator());
+        nodes.reserve(2 * sorted_leaves.size() - 1);
+        nodes[0].m_index = 0;
+
+        uint64_t code = 0;
+        std::size_t previous_length = lengths[order.front()];
+        for (auto leaf: order) {
+            auto length = std::size_t(lengths[leaf]);
+            assert(length > 0);
+            code <<= length - previous_length;
+            previous_length = length;
+
+            auto weight = sorted_leaves[leaf].get_content().value();
+            std::size_t parent = 0;
+            for (std::size_t depth = 0; depth < length; depth++) {
+                nodes[parent].set_content(nodes[parent].get_content().value() + weight);
+
+                auto bit = Bit((code >> (length - 1 - depth)) & 1);
+                auto child = bit ? nodes[parent].m_right_index : nodes[parent].m_left_index;
+                if (not child.has_value()) {
+                    auto is_leaf = depth + 1 == length;
+                    child = nodes.size();
+                    nodes.push_back(is_leaf ? sorted_leaves[leaf] : HuffmanNode(0));
+                    nodes.back().m_index = child;
+                    nodes.back().m_parent_index = parent;
+                    nodes.back().m_left_index = std::nullopt;
+                    nodes.back().m_right_index = std::nullopt;
+
+                    if (bit) {
+                        nodes[parent].m_right_index = child;
+                    } else {
+                        nodes[parent].m_left_index = child;
+                    }
+                }
+                parent = child.value();
+            }
 
-            //std::print("\n\n");
+            code++;
         }
 
-        assert(forest.size() == 1);
-
-        return forest.at(0);
+        assert(nodes.size() == 2 * sorted_leaves.size() - 1);
+        return nodes;
     }
 
     auto Huffman::encode_symbol_list(SymbolListType<Huffman>::type& symb_list) -> Code<HuffmanSymbol> {
@@ -353,6 +986,333 @@ namespace compadre {
         return code_tree.get_code_map();
     }
 
+    auto Huffman::encode_symbol_list(SymbolListType<Huffman>::type& symb_list, std::pmr::memory_resource* resource)
+        -> Code<HuffmanSymbol>
+    {
+        return Huffman::generate_code_tree(symb_list, resource).get_code_map();
+    }
+
+    Tunstall::Tunstall(const SymbolCounts& counts) {
+        auto alphabet = std::vector<u8>();
+        uint64_t total = 0;
+        for (std::size_t symb_id = 0; symb_id < symbol_table_size; symb_id++) {
+            if (counts[symb_id] > 0) {
+                alphabet.push_back(u8(symb_id));
+                total += counts[symb_id];
+            }
+        }
+
+        if (alphabet.empty()) {
+            return;
+        }
+        m_any_symbol = alphabet.front();
+
+        // Candidate strings, i.e. the leaves of the parse tree. Expanding
+        // a leaf makes it an internal node with one leaf per symbol.
+        struct Leaf {
+            double probability;
+            std::size_t parent;
+            u8 symb_id;
+            uint8_t length;
+            std::array<u8, max_string_length> string;
+            bool expanded = false;
+        };
+
+        auto leaves = std::vector<Leaf>();
+        auto parents = std::vector<std::size_t>{std::numeric_limits<std::size_t>::max()};
+        auto add_children = [&](std::size_t node, double probability, std::array<u8, max_string_length> prefix, uint8_t length) {
+            for (auto symb_id: alphabet) {
+                auto string = prefix;
+                string[length] = symb_id;
+                leaves.push_back({
+                    .probability = probability * double(counts[symb_id]) / double(total),
+                    .parent = node,
+                    .symb_id = symb_id,
+                    .length = uint8_t(length + 1),
+                    .string = string,
+                });
+            }
+        };
+        add_children(0, 1.0, {}, 0);
+
+        // The most probable leaf first; on ties, the older one.
+        auto less_probable = [&](std::size_t a, std::size_t b) {
+            return leaves[a].probability != leaves[b].probability
+                ? leaves[a].probability < leaves[b].probability
+                : a > b;
+        };
+        auto queue = std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(less_probable)>(less_probable);
+        for (std::size_t leaf = 0; leaf < leaves.size(); leaf++) {
+            queue.push(leaf);
+        }
+
+        auto strings_count = alphabet.size();
+        while (not queue.empty() && strings_count + alphabet.size() - 1 <= max_strings) {
+            auto leaf = queue.top();
+            queue.pop();
+            if (leaves[leaf].length == max_string_length) {
+                continue;
+            }
+
+            leaves[leaf].expanded = true;
+            auto node = parents.size();
+            parents.push_back(leaf);
+            auto first_child = leaves.size();
+            add_children(node, leaves[leaf].probability, leaves[leaf].string, leaves[leaf].length);
+            for (auto child = first_child; child < leaves.size(); child++) {
+                queue.push(child);
+            }
+            strings_count += alphabet.size() - 1;
+        }
+
+        // Internal nodes keep the order they were expanded in, the
+        // strings the order their leaves were created in.
+        m_nodes.resize(parents.size());
+        auto node_of_leaf = std::vector<std::size_t>(leaves.size(), 0);
+        for (std::size_t node = 1; node < parents.size(); node++) {
+            node_of_leaf[parents[node]] = node;
+        }
+
+        for (std::size_t leaf = 0; leaf < leaves.size(); leaf++) {
+            auto& child = m_nodes[leaves[leaf].parent][leaves[leaf].symb_id];
+            if (leaves[leaf].expanded) {
+                child = NodeRef(node_of_leaf[leaf]);
+                continue;
+            }
+
+            child = NodeRef(leaf_tag | m_lengths.size());
+            m_strings.push_back(leaves[leaf].string);
+            m_lengths.push_back(leaves[leaf].length);
+        }
+
+        assert(m_lengths.size() <= max_strings);
+        assert(m_nodes.size() < leaf_tag);
+    }
+
+    void Tunstall::encode(std::span<const u8> symb_ids, BitWriter& outbuff) const {
+        outbuff.reserve_bits(outbuff.bit_count() + symb_ids.size() * index_bits);
+
+        NodeRef node = 0;
+        for (auto symb_id: symb_ids) {
+            auto child = m_nodes[node][symb_id];
+            assert(child != 0 && "Symbol out of the dictionary.");
+            if ((child & leaf_tag) != 0) {
+                outbuff.write_bits(child & ~leaf_tag, index_bits);
+                node = 0;
+            } else {
+                node = child;
+            }
+        }
+
+        // A string cut by the end of the message: any string that starts
+        // with it will do, the decoder drops the symbols past the end.
+        if (node != 0) {
+            auto child = m_nodes[node][m_any_symbol];
+            while ((child & leaf_tag) == 0) {
+                child = m_nodes[child][m_any_symbol];
+            }
+            outbuff.write_bits(child & ~leaf_tag, index_bits);
+        }
+    }
+
+    auto Tunstall::decode(BitReader& inbuff, std::size_t symb_count) const -> std::optional<std::vector<u8>> {
+        static constexpr std::size_t per_refill = BitReader::max_peek_bits / index_bits;
+
+        // Room for a whole string past the end.
+        auto symb_ids = std::vector<u8>(symb_count + max_string_length);
+        std::size_t position = 0;
+        while (position < symb_count) {
+            inbuff.refill();
+            for (std::size_t read = 0; read < per_refill && position < symb_count; read++) {
+                auto index = inbuff.peek(index_bits);
+                inbuff.consume(index_bits);
+                if (index >= m_lengths.size()) [[unlikely]] {
+                    return std::nullopt;
+                }
+                std::memcpy(symb_ids.data() + position, m_strings[index].data(), max_string_length);
+                position += m_lengths[index];
+            }
+        }
+
+        symb_ids.resize(symb_count);
+        return symb_ids;
+    }
+
+    template class Compressor<PreprocessedPortugueseText::StaticModel, Huffman>;
+    template class Compressor<SemiStatic<0>, Huffman>;
+    template class Compressor<SemiStatic<1>, Huffman>;
+    template class Compressor<SemiStatic<0>, Rans<>>;
+    template class Compressor<PPM<HuffmanSymbol, 0>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 1>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 2>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 3>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 4>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 5>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 6>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 7>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 8>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 9>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 10>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 11>, Huffman>;
+    template class Compressor<PPM<HuffmanSymbol, 12>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 0>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 1>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 2>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 3>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 4>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 5>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 6>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 7>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 8>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 9>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 10>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 11>, Huffman>;
+    template class Compressor<HashedPPM<HuffmanSymbol, 12>, Huffman>;
+
+    auto EngineConfig::is_valid() const -> bool {
+        switch (model) {
+            case ModelKind::Static:
+                return order == 0 && coder == CoderKind::Huffman;
+            case ModelKind::SemiStatic:
+                return order <= max_semi_static_order
+                    && (coder == CoderKind::Huffman || (coder == CoderKind::Rans && order == 0));
+            case ModelKind::PPM:
+            case ModelKind::HashedPPM:
+                return order <= max_ppm_order && coder == CoderKind::Huffman;
+        }
+        return false;
+    }
+
+    void EngineConfig::write_to(BitWriter& outbuff) const {
+        assert(is_valid());
+        outbuff.write(uint8_t(model));
+        outbuff.write(order);
+        outbuff.write(uint8_t(coder));
+    }
+
+    auto EngineConfig::read_from(BitReader& inbuff) -> std::optional<EngineConfig> {
+        auto config = EngineConfig();
+        auto model = inbuff.read<uint8_t>();
+        config.order = inbuff.read<uint8_t>();
+        auto coder = inbuff.read<uint8_t>();
+        if (model > uint8_t(ModelKind::HashedPPM) || coder > uint8_t(CoderKind::Rans)) {
+            return std::nullopt;
+        }
+
+        config.model = ModelKind(model);
+        config.coder = CoderKind(coder);
+        if (not config.is_valid()) {
+            return std::nullopt;
+        }
+        return config;
+    }
+
+    template <std::size_t Order>
+    using PPMEngine = Compressor<PPM<HuffmanSymbol, Order>, Huffman>;
+
+    template <std::size_t Order>
+    using HashedPPMEngine = Compressor<HashedPPM<HuffmanSymbol, Order>, Huffman>;
+
+    // Calls `fn` with the std::type_identity of Engine<order>, through a
+    // table with one entry per order.
+    template <template <std::size_t> typename Engine, typename Fn, std::size_t... Orders>
+    static auto with_engine_of_order(uint8_t order, Fn& fn, std::index_sequence<Orders...> /*orders*/) {
+        using Result = std::invoke_result_t<Fn&, std::type_identity<Engine<0>>>;
+        static constexpr auto engines = std::array<Result(*)(Fn&), sizeof...(Orders)>{
+            [](Fn& engine_fn) -> Result { return engine_fn(std::type_identity<Engine<Orders>>()); }...
+        };
+
+        assert(order < engines.size());
+        return engines[order](fn);
+    }
+
+    template <template <std::size_t> typename Engine, typename Fn>
+    static auto with_engine_of_order(uint8_t order, Fn& fn) {
+        return with_engine_of_order<Engine>(order, fn, std::make_index_sequence<EngineConfig::max_ppm_order + 1>());
+    }
+
+    // Calls `fn` with the std::type_identity of the engine of `config`;
+    // `fn` returns the same type for all of them.
+    template <typename Fn>
+    static auto with_engine(const EngineConfig& config, Fn& fn) {
+        assert(config.is_valid());
+        switch (config.model) {
+            case ModelKind::Static:
+                return fn(std::type_identity<Compressor<PreprocessedPortugueseText::StaticModel, Huffman>>());
+            case ModelKind::SemiStatic:
+                if (config.coder == CoderKind::Rans) {
+                    return fn(std::type_identity<Compressor<SemiStatic<0>, Rans<>>>());
+                }
+                if (config.order == 0) {
+                    return fn(std::type_identity<Compressor<SemiStatic<0>, Huffman>>());
+                }
+                return fn(std::type_identity<Compressor<SemiStatic<1>, Huffman>>());
+            case ModelKind::HashedPPM:
+                return with_engine_of_order<HashedPPMEngine>(config.order, fn);
+            case ModelKind::PPM:
+                break;
+        }
+        return with_engine_of_order<PPMEngine>(config.order, fn);
+    }
+
+    auto compress_with_engine(const EngineConfig& config, const EngineOptions& options, PreprocessedPortugueseText& text) -> std::vector<u8> {
+        assert((options.snapshot == nullptr || config.model != ModelKind::PPM
+                    || options.snapshot->order() == config.order) && "Snapshot of another order.");
+        assert((options.snapshot == nullptr || config.model != ModelKind::HashedPPM)
+                && "The hashed PPM does not start from snapshots.");
+
+        auto compress = [&]<typename Engine>(std::type_identity<Engine> /*engine*/) {
+            auto compressor = Engine();
+            compressor.set_snapshot(options.snapshot);
+            compressor.set_dictionary_mode(options.dictionary_mode);
+            return compressor.compress_preprocessed_portuguese_text(text);
+        };
+
+        auto outbuff = BitWriter();
+        config.write_to(outbuff);
+        auto stream = outbuff.finish();
+        auto compressed = with_engine(config, compress);
+        stream.insert(stream.end(), compressed.begin(), compressed.end());
+        return stream;
+    }
+
+    auto decompress_with_engine(std::span<const u8> data, const ModelSnapshot* snapshot) -> std::optional<PreprocessedPortugueseText> {
+        if (data.size() < EngineConfig::header_size) {
+            return std::nullopt;
+        }
+
+        auto inbuff = BitReader(data);
+        auto config = EngineConfig::read_from(inbuff);
+        if (not config.has_value()) {
+            return std::nullopt;
+        }
+        if (snapshot != nullptr && config->model == ModelKind::PPM && snapshot->order() != config->order) {
+            return std::nullopt;
+        }
+
+        auto payload = data.subspan(EngineConfig::header_size);
+        auto decompress = [&]<typename Engine>(std::type_identity<Engine> /*engine*/) {
+            auto compressor = Engine();
+            // Only the exact PPM starts from one. The stream header names
+            // its snapshot by id, and a mismatch decodes nothing.
+            compressor.set_snapshot(config->model == ModelKind::PPM ? snapshot : nullptr);
+            return compressor.try_decompress_preprocessed_portuguese_text(payload);
+        };
+        return with_engine(config.value(), decompress);
+    }
+
+    auto train_engine_snapshot(const EngineConfig& config, const EngineOptions& options, PreprocessedPortugueseText& text) -> std::vector<u8> {
+        assert(config.model == ModelKind::PPM && config.is_valid());
+
+        auto train = [&]<typename Engine>(std::type_identity<Engine> /*engine*/) {
+            auto compressor = Engine();
+            compressor.set_snapshot(options.snapshot);
+            compressor.set_dictionary_mode(options.dictionary_mode);
+            return compressor.train_snapshot(text);
+        };
+        return with_engine_of_order<PPMEngine>(config.order, train);
+    }
+
     /*
     auto StaticCompressor::compress_preprocessed_portuguese_text(PreprocessedPortugueseText& text) -> std::vector<u8> {
         assert(text.as_string().size() < std::size_t(std::numeric_limits<uint32_t>::max)
@@ -3,10 +3,20 @@
 #include <outbit/BitBuffer.hpp>
 #include <print>
 #include <string>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <array>
+#include <span>
+#include <limits>
+#include <bit>
+#include <cstring>
 #include <unordered_map>
 #include <utility>
 #include <format>
 #include <cmath>
+#include <numeric>
+#include <algorithm>
 
 namespace compadre {
 
@@ -21,25 +31,411 @@ namespace compadre {
         { Model::occurencies_of(symb) } -> std::same_as<uint32_t>;
     };
 
+    // Encoder side bit writer. Codes are OR'ed into a 64-bit accumulator,
+    // first bit at bit 0, and only whole words are stored to the output.
+    // The output is sized ahead (reserve_bits), so the store does not
+    // check for room in the common case. Bits are packed LSB-first and
+    // words stored little-endian, the order BitReader reads back.
+    class BitWriter {
+        private:
+            std::vector<u8> m_bytes;
+            std::size_t m_byte_count = 0;
+            uint64_t m_accumulator = 0;
+            std::size_t m_bit_count = 0;
+
+            void grow();
+
+            inline void store_word(uint64_t word) {
+                if (m_byte_count + sizeof(word) > m_bytes.size()) [[unlikely]] {
+                    grow();
+                }
+
+                if constexpr (std::endian::native == std::endian::big) {
+                    word = std::byteswap(word);
+                }
+                std::memcpy(m_bytes.data() + m_byte_count, &word, sizeof(word));
+                m_byte_count += sizeof(word);
+            }
+        public:
+            static constexpr std::size_t max_write_bits = 64;
+
+            BitWriter() = default;
+            explicit BitWriter(std::size_t expected_bits) {
+                reserve_bits(expected_bits);
+            }
+
+            void reserve_bits(std::size_t bit_count);
+
+            // Appends the `length` low bits of `bits`, bit 0 first.
+            inline void write_bits(uint64_t bits, std::size_t length) {
+                assert(length <= max_write_bits);
+                assert(length == max_write_bits || (bits >> length) == 0);
+
+                m_accumulator |= bits << m_bit_count;
+                auto total = m_bit_count + length;
+
+                if (total >= 64) {
+                    store_word(m_accumulator);
+                    total -= 64;
+                    // The bits that did not fit; split in two shifts so
+                    // a full 64-bit write never shifts by 64.
+                    m_accumulator = (bits >> (length - total - 1)) >> 1;
+                }
+
+                m_bit_count = total;
+            }
+
+            template <std::unsigned_integral T>
+            inline void write(T value) {
+                write_bits(value, sizeof(T) * 8);
+            }
+
+            // Zeros up to the next byte boundary.
+            inline void align_to_byte() {
+                write_bits(0, (8 - m_bit_count % 8) % 8);
+            }
+
+            [[nodiscard]]
+            inline std::size_t bit_count() const { return m_byte_count * 8 + m_bit_count; }
+
+            // Stores the pending bits (the last byte is padded with zeros)
+            // and hands the output over.
+            auto finish() -> std::vector<u8>;
+    };
+
+    // Decoder side bit reader, straight over the compressed bytes. Bit 0
+    // of the 64-bit window is the next bit of the stream: peek(n) looks at
+    // the next n bits and consume(n) drops them. refill() tops the window
+    // up to at least 56 bits with one unaligned 8-byte load and no
+    // branches, except near the end of the data, where the missing bytes
+    // are read as zeros.
+    class BitReader {
+        private:
+            std::span<const u8> m_bytes;
+            // First byte not yet loaded in the window.
+            std::size_t m_byte_index = 0;
+            uint64_t m_window = 0;
+            std::size_t m_bit_count = 0;
+
+            [[nodiscard]]
+            auto load_tail() const -> uint64_t;
+        public:
+            static constexpr std::size_t max_peek_bits = 56;
+
+            BitReader() = default;
+            explicit BitReader(std::span<const u8> bytes)
+                : m_bytes(bytes)
+            {
+            }
+
+            inline void refill() {
+                uint64_t chunk;
+                if (m_byte_index + sizeof(chunk) <= m_bytes.size()) [[likely]] {
+                    std::memcpy(&chunk, m_bytes.data() + m_byte_index, sizeof(chunk));
+                    if constexpr (std::endian::native == std::endian::big) {
+                        chunk = std::byteswap(chunk);
+                    }
+                } else {
+                    chunk = load_tail();
+                }
+
+                // The bits above m_bit_count are the same stream bits the
+                // next load brings, so OR'ing them again is harmless.
+                m_window |= chunk << m_bit_count;
+                m_byte_index += (63 - m_bit_count) >> 3;
+                m_bit_count |= max_peek_bits;
+            }
+
+            [[nodiscard]]
+            inline uint64_t peek(std::size_t bit_count) const {
+                assert(bit_count <= m_bit_count && bit_count < 64);
+                return m_window & ((uint64_t(1) << bit_count) - 1);
+            }
+
+            inline void consume(std::size_t bit_count) {
+                assert(bit_count <= m_bit_count);
+                m_window >>= bit_count;
+                m_bit_count -= bit_count;
+            }
+
+            // Window with all the buffered bits, for walks that consume
+            // an unknown number of them (up to max_peek_bits).
+            [[nodiscard]]
+            inline uint64_t window() const { return m_window; }
+
+            inline uint64_t read_bits(std::size_t bit_count) {
+                assert(bit_count <= max_peek_bits);
+                if (m_bit_count < bit_count) {
+                    refill();
+                }
+                auto bits = peek(bit_count);
+                consume(bit_count);
+                return bits;
+            }
+
+            template <std::unsigned_integral T>
+            inline T read() {
+                static_assert(sizeof(T) * 8 <= max_peek_bits);
+                return T(read_bits(sizeof(T) * 8));
+            }
+
+            // Bits consumed so far (refill keeps the window aligned with
+            // the loaded bytes).
+            [[nodiscard]]
+            inline std::size_t bit_position() const { return m_byte_index * 8 - m_bit_count; }
+    };
+
+    // Symbol ids packed with 5 bits each: every group of 8 symbols
+    // takes exactly 5 bytes.
+    class PackedSymbolBuffer {
+        private:
+            // Always one byte longer than the packed bits, so any symbol
+            // can be read with a two byte load.
+            std::vector<u8> m_bytes = std::vector<u8>(1);
+            std::size_t m_size = 0;
+
+            void append_group(const u8* symbol_ids);
+            void unpack_group(std::size_t first, u8* symbol_ids) const;
+        public:
+            static constexpr std::size_t bits_per_symbol = 5;
+            static constexpr std::size_t group_symbols = 8;
+            static constexpr std::size_t group_bytes = 5;
+            static constexpr u8 symbol_mask = 0x1F;
+
+            class const_iterator {
+                private:
+                    const PackedSymbolBuffer* m_buffer = nullptr;
+                    std::size_t m_index = 0;
+                public:
+                    using value_type = u8;
+                    using difference_type = std::ptrdiff_t;
+
+                    const_iterator() = default;
+                    const_iterator(const PackedSymbolBuffer* buffer, std::size_t index)
+                        : m_buffer(buffer), m_index(index)
+                    {
+                    }
+
+                    inline u8 operator*() const { return (*m_buffer)[m_index]; }
+                    inline const_iterator& operator++() { m_index++; return *this; }
+                    inline const_iterator operator++(int) { auto it = *this; m_index++; return it; }
+                    bool operator==(const const_iterator&) const = default;
+            };
+
+            PackedSymbolBuffer() = default;
+
+            static auto pack(std::span<const u8> symbol_ids) -> PackedSymbolBuffer;
+            // Bulk kernels: whole groups are packed/unpacked at once.
+            void append(std::span<const u8> symbol_ids);
+            void unpack(std::size_t first, std::span<u8> symbol_ids) const;
+
+            inline void reserve(std::size_t symbol_count) {
+                m_bytes.reserve((symbol_count * bits_per_symbol + 7) / 8 + 1);
+            }
+
+            inline void push_back(u8 symbol_id) {
+                assert(symbol_id <= symbol_mask);
+                auto bit_index = m_size * bits_per_symbol;
+                auto byte_index = bit_index / 8;
+                auto shifted = uint16_t(symbol_id << (bit_index % 8));
+
+                m_bytes.resize(byte_index + 2);
+                m_bytes[byte_index] |= u8(shifted);
+                m_bytes[byte_index + 1] |= u8(shifted >> 8);
+                m_size++;
+            }
+
+            inline u8 operator[](std::size_t index) const {
+                auto bit_index = index * bits_per_symbol;
+                auto byte_index = bit_index / 8;
+                auto two_bytes = uint16_t(m_bytes[byte_index] | (m_bytes[byte_index + 1] << 8));
+                return u8(two_bytes >> (bit_index % 8)) & symbol_mask;
+            }
+
+            [[nodiscard]]
+            inline std::size_t size() const { return m_size; }
+            [[nodiscard]]
+            inline bool empty() const { return m_size == 0; }
+            [[nodiscard]]
+            inline std::size_t byte_size() const { return m_bytes.size(); }
+
+            [[nodiscard]]
+            inline auto begin() const { return const_iterator(this, 0); }
+            [[nodiscard]]
+            inline auto end() const { return const_iterator(this, m_size); }
+    };
+
+    // Calls `fn` with consecutive blocks of the symbol ids of `msg`, so the
+    // coding kernels always run over plain contiguous ids.
+    template <typename Message, typename Fn>
+    inline void for_each_symbol_block(const Message& msg, Fn&& fn) {
+        if constexpr (std::same_as<Message, PackedSymbolBuffer>) {
+            auto block = std::array<u8, 256>();
+            for (std::size_t first = 0; first < msg.size(); first += block.size()) {
+                auto count = std::min(block.size(), msg.size() - first);
+                msg.unpack(first, std::span(block).first(count));
+                fn(std::span<const u8>(block.data(), count));
+            }
+        } else {
+            fn(std::span<const u8>(msg));
+        }
+    }
+
+    // Symbol ids of `msg`, one per byte.
+    template <typename Message>
+    auto unpack_symbols(const Message& msg) -> std::vector<u8> {
+        auto symb_ids = std::vector<u8>();
+        symb_ids.reserve(msg.size());
+        for_each_symbol_block(msg, [&](std::span<const u8> block) {
+            symb_ids.insert(symb_ids.end(), block.begin(), block.end());
+        });
+        return symb_ids;
+    }
+
+    // Bulk append of decoded ids to any of the decoders' outputs.
+    template <typename Output>
+    inline void append_symbols(Output& output, std::span<const u8> symb_ids) {
+        if constexpr (std::same_as<Output, PackedSymbolBuffer>) {
+            output.append(symb_ids);
+        } else {
+            output.insert(output.end(), symb_ids.begin(), symb_ids.end());
+        }
+    }
+
     class PreprocessedPortugueseText {
         private:
-            std::string m_text;
+            PackedSymbolBuffer m_symbols;
         public:
             PreprocessedPortugueseText(const std::string&);
-            inline const std::string& as_string() { return m_text; }
-            static const std::array<char, 27> char_list;
+            PreprocessedPortugueseText(PackedSymbolBuffer symbols)
+                : m_symbols(std::move(symbols))
+            {
+            }
+
+            // Packs a text that already went through preprocess_portuguese_text.
+            static auto from_preprocessed(const std::string& text) -> PreprocessedPortugueseText;
+
+            // The text as chars, unpacked anew on every call.
+            [[nodiscard]]
+            auto as_string() const -> std::string;
+            [[nodiscard]]
+            inline const PackedSymbolBuffer& symbols() const { return m_symbols; }
+            [[nodiscard]]
+            inline std::size_t size() const { return m_symbols.size(); }
+
+            static constexpr std::array<char, 27> char_list = {
+                ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K',
+                'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W',
+                'X', 'Y', 'Z'
+            };
 
             class StaticModel {
                 public:
-                    static std::unordered_map<char, float> char_frequencies;
-
-                    inline
-                    static auto occurencies_of(char symb) -> uint32_t {
-                        return uint32_t(char_list[symb] * 1000.0);
-                    }
+                    // Frequency (%) of each char, in char_list order.
+                    static constexpr std::array<float, 27> char_frequencies = {
+                        17.00, 13.72, 1.04, 3.88, 4.99, 14.63, 1.02, 1.30, 1.28,
+                        6.18, 0.40, 0.02, 2.78, 4.74, 5.05, 10.73, 2.52, 1.20,
+                        6.53, 7.81, 4.34, 4.63, 1.67, 0.01, 0.27, 0.01, 0.47
+                    };
+
+                    static constexpr auto occurencies_of(char symb) -> uint32_t;
             };
     };
 
+    enum class DictionaryMode: uint8_t {
+        None,
+        BuiltIn,
+        PerStream,
+    };
+
+    // Optional stage applied after `preprocess_portuguese_text`: frequent
+    // words are replaced by a single token symbol, so the coders see a
+    // shorter stream. Tokens are the chars 0x80.. and never collide with
+    // the 27 symbols of the preprocessed text.
+    class WordDictionary {
+        private:
+            std::vector<std::string> m_words;
+            std::unordered_map<std::string, uint8_t> m_index_of;
+        public:
+            static constexpr std::size_t max_words = 64;
+            static constexpr unsigned char first_token = 0x80;
+
+            WordDictionary() = default;
+            WordDictionary(std::vector<std::string> words);
+
+            // Most frequent Portuguese words (without accents).
+            static auto portuguese() -> WordDictionary;
+            // Words of `text` that save the most symbols when tokenized.
+            static auto from_text(const std::string& text, std::size_t word_count = max_words) -> WordDictionary;
+
+            // Empty when the words are too many or not preprocessed text.
+            static auto read_from(BitReader& inbuff) -> std::optional<WordDictionary>;
+            void write_to(BitWriter& outbuff) const;
+            [[nodiscard]]
+            auto serialized_size() const -> std::size_t;
+
+            [[nodiscard]]
+            auto tokenize(const std::string& text) const -> std::string;
+            [[nodiscard]]
+            auto detokenize(const std::string& tokens) const -> std::string;
+
+            // Token weights follow Zipf's law over the dictionary rank,
+            // in the same scale as StaticModel::occurencies_of.
+            [[nodiscard]]
+            auto occurencies_of(char token) const -> uint32_t;
+
+            [[nodiscard]]
+            auto tokens() const -> std::vector<char>;
+
+            static constexpr bool is_token(char ch) {
+                return static_cast<unsigned char>(ch) >= first_token;
+            }
+
+            static constexpr auto token_of(std::size_t index) -> char {
+                return static_cast<char>(first_token + index);
+            }
+
+            static constexpr auto index_of(char token) -> std::size_t {
+                return static_cast<unsigned char>(token) - first_token;
+            }
+
+            [[nodiscard]]
+            inline auto words() const -> const std::vector<std::string>& { return m_words; }
+            [[nodiscard]]
+            inline std::size_t size() const { return m_words.size(); }
+    };
+
+    // Dense symbol ids: the position in `char_list` for the symbols of the
+    // preprocessed text, followed by the dictionary tokens.
+    inline constexpr std::size_t symbol_id_count =
+        PreprocessedPortugueseText::char_list.size() + WordDictionary::max_words;
+
+    inline constexpr auto char_list_ids = [] {
+        auto ids = std::array<u8, 128>();
+        ids.fill(std::numeric_limits<u8>::max());
+        for (std::size_t id = 0; id < PreprocessedPortugueseText::char_list.size(); id++) {
+            ids[std::size_t(PreprocessedPortugueseText::char_list[id])] = u8(id);
+        }
+        return ids;
+    }();
+
+    constexpr auto symbol_id(char ch) -> u8 {
+        if (WordDictionary::is_token(ch)) {
+            return u8(PreprocessedPortugueseText::char_list.size() + WordDictionary::index_of(ch));
+        }
+
+        assert(char_list_ids[std::size_t(ch)] != std::numeric_limits<u8>::max());
+        return char_list_ids[std::size_t(ch)];
+    }
+
+    constexpr auto symbol_char(u8 id) -> char {
+        if (id < PreprocessedPortugueseText::char_list.size()) {
+            return PreprocessedPortugueseText::char_list[id];
+        }
+
+        return WordDictionary::token_of(id - PreprocessedPortugueseText::char_list.size());
+    }
+
     template<typename InnerType, typename Attribute>
     struct Symbol {
         private:
@@ -112,73 +508,341 @@ namespace compadre {
     std::same_as<SpecializedSymbol,
         Symbol<typename SpecializedSymbol::inner_type, typename SpecializedSymbol::attribute_type>>;
 
+    // The unknown symbol (rho) takes the id after the dense ones.
+    inline constexpr u8 unknown_symbol_id = u8(symbol_id_count);
+    // Size of the tables indexed by symbol id.
+    inline constexpr std::size_t symbol_table_size = std::size_t(unknown_symbol_id) + 1;
+
+    // Code length of every symbol id, zero for the symbols without code.
+    using CodeLengths = std::array<uint8_t, symbol_table_size>;
+    // Count of every symbol id.
+    using SymbolCounts = std::array<uint32_t, symbol_table_size>;
+
+    // Header form of a code: the bit width of a length, then the length
+    // of each one of `symb_ids`. Reading it back is empty when the
+    // lengths are no prefix code.
+    void write_code_lengths(BitWriter& outbuff, const CodeLengths& lengths, std::span<const u8> symb_ids);
+    auto read_code_lengths(BitReader& inbuff, std::span<const u8> symb_ids) -> std::optional<CodeLengths>;
+
+    // Counts scaled to a total of about `max_total`; the symbols with
+    // some count keep at least 1.
+    auto scaled_counts(const SymbolCounts& counts, uint32_t max_total) -> SymbolCounts;
+
+    // Counts scaled to a total of exactly 2^total_bits; the symbols with
+    // some count keep at least 1. All zero counts stay zero.
+    auto quantized_counts(const SymbolCounts& counts, std::size_t total_bits) -> SymbolCounts;
+
+    // Header form of counts, as for the code lengths.
+    void write_symbol_counts(BitWriter& outbuff, const SymbolCounts& counts, std::span<const u8> symb_ids);
+    auto read_symbol_counts(BitReader& inbuff, std::span<const u8> symb_ids) -> SymbolCounts;
+
+    // Symbol counts of a message. Consecutive ids go to different tables,
+    // so runs of the same symbol do not serialize on a single counter and
+    // the compiler can vectorize the final sum.
+    class SymbolHistogram {
+        private:
+            static constexpr std::size_t table_count = 4;
+            std::array<SymbolCounts, table_count> m_tables{};
+        public:
+            void add(std::span<const u8> symb_ids);
+
+            [[nodiscard]]
+            auto counts() const -> SymbolCounts;
+    };
+
+    constexpr auto PreprocessedPortugueseText::StaticModel::occurencies_of(char symb) -> uint32_t {
+        return uint32_t(char_frequencies[symbol_id(symb)] * 1000.0);
+    }
+
+    template<typename Attribute>
+    inline auto symbol_id(const Symbol<char, Attribute>& symbol) -> u8 {
+        return symbol.is_unknown() ? unknown_symbol_id : symbol_id(symbol.inner().value());
+    }
+
+    template<ValidSymbol SpecializedSymbol>
+    inline auto symbol_from_id(u8 symb_id) -> SpecializedSymbol {
+        return symb_id == unknown_symbol_id
+            ? SpecializedSymbol()
+            : SpecializedSymbol(symbol_char(symb_id));
+    }
+
+    // Codeword in emission order: bit 0 is the first bit written (the
+    // branch taken at the root). Always built whole, never bit by bit.
+    struct CodeWord {
+        uint64_t bits = 0;
+        uint8_t length = 0;
+
+        static constexpr std::size_t max_length = 64;
 
-    class CodeWord {
+        // From a code value read root first, i.e. with the root branch
+        // in the most significant of the `length` bits.
+        static constexpr auto from_msb_first(uint64_t code, uint8_t length) -> CodeWord {
+            assert(length <= max_length);
+            if (length == 0) {
+                return {};
+            }
+
+            // Bit reversal of the whole word, then drop the unused bits.
+            auto reversed = std::byteswap(code);
+            reversed = ((reversed >> 4) & 0x0F0F0F0F0F0F0F0F) | ((reversed & 0x0F0F0F0F0F0F0F0F) << 4);
+            reversed = ((reversed >> 2) & 0x3333333333333333) | ((reversed & 0x3333333333333333) << 2);
+            reversed = ((reversed >> 1) & 0x5555555555555555) | ((reversed & 0x5555555555555555) << 1);
+            return {.bits = reversed >> (max_length - length), .length = length};
+        }
+
+        // Code of the child reached through `bit`.
+        [[nodiscard]]
+        constexpr auto append(Bit bit) const -> CodeWord {
+            assert(length < max_length);
+            return {.bits = bits | (uint64_t(bit) << length), .length = uint8_t(length + 1)};
+        }
+    };
+
+    // Code of every symbol, indexed by its dense id (see symbol_id).
+    // The codewords are in emission order, so they go to the output as is.
+    template<ValidSymbol SpecializedSymbol>
+    class Code {
+        public:
+            static constexpr std::size_t table_size = symbol_table_size;
+        private:
+            std::array<CodeWord, table_size> m_table{};
+            std::array<bool, table_size> m_has_code{};
+            uint8_t m_max_length = 0;
         public:
-            std::bitset<32> m_bits;
-            std::size_t m_bit_count;
+            constexpr const CodeWord& operator[](u8 symb_id) const {
+                assert(m_has_code[symb_id]);
+                return m_table[symb_id];
+            }
+
+            auto get(const SpecializedSymbol& symb) const -> std::optional<CodeWord> {
+                auto symb_id = symbol_id(symb);
+                if (not m_has_code[symb_id]) {
+                    return std::nullopt;
+                }
+
+                return m_table[symb_id];
+            }
 
-            CodeWord() = default;
-            inline void push_right_bit(Bit bit) {
-                // Bounds checking
-                m_bits.test(m_bit_count);
-                m_bits <<= 1;
-                m_bits[0] = bit;
-                m_bit_count++;
+            constexpr void set(u8 symb_id, CodeWord code_word) {
+                assert(symb_id < table_size);
+                m_table[symb_id] = code_word;
+                m_has_code[symb_id] = true;
+                m_max_length = std::max(m_max_length, code_word.length);
             }
 
-            inline void push_left_bit(Bit bit) {
-                // Bounds checking
-                m_bits.test(m_bit_count);
-                m_bits[m_bit_count] = bit;
-                m_bit_count++;
+            [[nodiscard]]
+            constexpr bool has_code(std::size_t symb_id) const { return m_has_code[symb_id]; }
+
+            [[nodiscard]]
+            constexpr std::size_t max_length() const { return m_max_length; }
+
+            [[nodiscard]]
+            constexpr auto code_lengths() const -> CodeLengths {
+                auto lengths = CodeLengths{};
+                for (std::size_t symb_id = 0; symb_id < table_size; symb_id++) {
+                    lengths[symb_id] = m_table[symb_id].length;
+                }
+                return lengths;
             }
 
-            void reverse_valid_bits() {
-                for (std::size_t i = 0; i < m_bit_count / 2; ++i) {
-                    bool bit1 = m_bits[i];
-                    bool bit2 = m_bits[m_bit_count - 1 - i];
+            // Encoding kernel. While two codes fit in one write they are
+            // joined, so the writer handles half as many appends.
+            inline void encode(std::span<const u8> symb_ids, BitWriter& writer) const {
+                std::size_t index = 0;
+                if (2 * max_length() <= BitWriter::max_write_bits) {
+                    for (; index + 2 <= symb_ids.size(); index += 2) {
+                        const auto& first = (*this)[symb_ids[index]];
+                        const auto& second = (*this)[symb_ids[index + 1]];
+                        writer.write_bits(
+                            first.bits | (second.bits << first.length),
+                            first.length + second.length
+                        );
+                    }
+                }
 
-                    m_bits[i] = bit2;
-                    m_bits[m_bit_count - 1 - i] = bit1;
+                for (; index < symb_ids.size(); index++) {
+                    const auto& code_word = (*this)[symb_ids[index]];
+                    writer.write_bits(code_word.bits, code_word.length);
                 }
             }
 
-            inline std::size_t length() { return m_bit_count; }
+            // Round-robin over `writers`: symb_ids[i] goes to the writer of
+            // message position `first + i`.
+            inline void encode_interleaved(std::span<const u8> symb_ids, std::span<BitWriter> writers, std::size_t first) const {
+                auto stream = first % writers.size();
+                for (u8 symb_id: symb_ids) {
+                    const auto& code_word = (*this)[symb_id];
+                    writers[stream].write_bits(code_word.bits, code_word.length);
+                    stream = stream + 1 == writers.size() ? 0 : stream + 1;
+                }
+            }
     };
 
+    // Canonical code for the given lengths: shorter codes first and, within
+    // a length, by symbol id. Only the lengths are needed to rebuild it.
     template<ValidSymbol SpecializedSymbol>
-    class Code {
-        std::vector<std::pair<SpecializedSymbol, CodeWord>> m_code;
+    constexpr auto canonical_code(const CodeLengths& lengths) -> Code<SpecializedSymbol> {
+        auto code = Code<SpecializedSymbol>();
+        uint64_t next_code = 0;
+        uint8_t previous_length = 0;
+
+        for (uint8_t length = 1; length <= CodeWord::max_length; length++) {
+            for (std::size_t symb_id = 0; symb_id < lengths.size(); symb_id++) {
+                if (lengths[symb_id] != length) {
+                    continue;
+                }
+
+                next_code <<= length - previous_length;
+                previous_length = length;
+                code.set(u8(symb_id), CodeWord::from_msb_first(next_code, length));
+                next_code++;
+            }
+        }
+
+        return code;
+    }
 
+    // Decoding with a single lookup for codes of up to `width` bits: the
+    // next `width` bits of the stream index the symbol and the length of
+    // its code. Every code fills the 2^(width - length) entries that
+    // start with it.
+    class DecodeTable {
+        public:
+            static constexpr std::size_t width = 11;
+
+            struct Entry {
+                u8 symbol_id = 0;
+                uint8_t length = 0;
+            };
+        private:
+            std::array<Entry, std::size_t(1) << width> m_entries{};
         public:
-        auto get(SpecializedSymbol symb) -> std::optional<CodeWord> {
-            for (auto& [symbol, cword] : m_code) {
-                if (symb == symbol) {
-                    return std::make_optional(cword);
+            template<ValidSymbol SpecializedSymbol>
+            constexpr explicit DecodeTable(const Code<SpecializedSymbol>& code) {
+                assert(code.max_length() <= width);
+
+                for (std::size_t symb_id = 0; symb_id < code.table_size; symb_id++) {
+                    if (not code.has_code(symb_id)) {
+                        continue;
+                    }
+
+                    const auto& code_word = code[u8(symb_id)];
+                    auto entry = Entry{.symbol_id = u8(symb_id), .length = code_word.length};
+                    for (auto index = code_word.bits;
+                            index < m_entries.size();
+                            index += uint64_t(1) << code_word.length)
+                    {
+                        m_entries[index] = entry;
+                    }
                 }
             }
 
-            return std::nullopt;
-        }
+            // The caller refills `reader`: one refill covers
+            // BitReader::max_peek_bits / width symbols.
+            inline auto decode(BitReader& reader) const -> u8 {
+                const auto& entry = m_entries[reader.peek(width)];
+                reader.consume(entry.length);
+                return entry.symbol_id;
+            }
+    };
 
-        void set(SpecializedSymbol symb, CodeWord code_word) {
-            for (auto& [symbol, cword] : m_code) {
-                if (symb == symbol) {
-                    cword = code_word;
-                    return;
+    // Decode table whose entries hold every whole code that fits in the
+    // next `width` bits, up to `max_symbols` of them. With the ~4 bits
+    // average of the Portuguese codes a lookup yields 2 to 3 symbols.
+    class MultiSymbolDecodeTable {
+        public:
+            static constexpr std::size_t width = 12;
+            static constexpr std::size_t max_symbols = 3;
+
+            struct Entry {
+                std::array<u8, max_symbols> symbol_ids{};
+                uint8_t count = 0;
+                // Bits of all the codes in the entry.
+                uint8_t length = 0;
+            };
+        private:
+            std::array<Entry, std::size_t(1) << width> m_entries{};
+        public:
+            template<ValidSymbol SpecializedSymbol>
+            constexpr explicit MultiSymbolDecodeTable(const Code<SpecializedSymbol>& code) {
+                assert(code.max_length() <= width);
+
+                // Single symbol entries first, as in DecodeTable.
+                for (std::size_t symb_id = 0; symb_id < code.table_size; symb_id++) {
+                    if (not code.has_code(symb_id)) {
+                        continue;
+                    }
+
+                    const auto& code_word = code[u8(symb_id)];
+                    for (auto index = code_word.bits;
+                            index < m_entries.size();
+                            index += uint64_t(1) << code_word.length)
+                    {
+                        m_entries[index].symbol_ids[0] = u8(symb_id);
+                        m_entries[index].count = 1;
+                        m_entries[index].length = code_word.length;
+                    }
+                }
+
+                // Then the codes that follow while they still fit: the bits
+                // after the codes already in the entry index the entry of
+                // the next one, valid only if it ends within `width`. That
+                // index is smaller, so going downwards it still holds a
+                // single symbol. Entry 0 is also the next one of itself, so
+                // its single form is kept aside.
+                const auto first_entry = m_entries[0];
+                for (auto index = m_entries.size(); index-- > 0;) {
+                    auto& entry = m_entries[index];
+                    while (entry.count > 0 && entry.count < max_symbols) {
+                        auto next_index = index >> entry.length;
+                        const auto& next = next_index == 0 ? first_entry : m_entries[next_index];
+                        if (next.count == 0 || entry.length + next.length > width) {
+                            break;
+                        }
+
+                        entry.symbol_ids[entry.count] = next.symbol_ids[0];
+                        entry.count++;
+                        entry.length = uint8_t(entry.length + next.length);
+                    }
                 }
             }
 
-            m_code.push_back(std::make_pair(symb, code_word));
-        }
+            // Writes max_symbols ids to `symb_ids` and returns how many of
+            // them are decoded. The caller refills `reader`: one refill
+            // covers BitReader::max_peek_bits / width lookups.
+            inline auto decode(BitReader& reader, u8* symb_ids) const -> std::size_t {
+                const auto& entry = m_entries[reader.peek(width)];
+                std::memcpy(symb_ids, entry.symbol_ids.data(), max_symbols);
+                reader.consume(entry.length);
+                return entry.count;
+            }
     };
 
     template<ValidSymbol SpecializedSymbol>
     class SymbolList {
         using symbol_type = SpecializedSymbol;
         public:
+            // The adaptive models keep their lists in arenas (see PPM).
+            using allocator_type = std::pmr::polymorphic_allocator<SpecializedSymbol>;
+
             SymbolList() = default;
+            explicit SymbolList(const allocator_type& allocator)
+                : m_list(allocator)
+            {
+            }
+            SymbolList(const SymbolList& other, const allocator_type& allocator)
+                : m_list(other.m_list, allocator)
+            {
+            }
+            SymbolList(SymbolList&& other, const allocator_type& allocator)
+                : m_list(std::move(other.m_list), allocator)
+            {
+            }
+            SymbolList(const SymbolList&) = default;
+            SymbolList(SymbolList&&) noexcept = default;
+            auto operator=(const SymbolList&) -> SymbolList& = default;
+            auto operator=(SymbolList&&) -> SymbolList& = default;
+
             void sort_by_attribute();
             bool is_sorted();
             void push(SpecializedSymbol symb);
@@ -188,6 +852,8 @@ namespace compadre {
             void remove(const SpecializedSymbol& symb);
             void remove_at(std::size_t index);
             bool contains(SpecializedSymbol symb);
+            // Keeps the memory, for lists rebuilt over and over.
+            inline void clear() { m_list.clear(); }
             void print() {
                 std::print("SymbolList: ");
                 for (auto& symb: m_list) {
@@ -210,7 +876,7 @@ namespace compadre {
             inline std::size_t size() { return m_list.size(); }
             inline SpecializedSymbol front() { return *m_list.begin(); }
         private:
-            std::vector<SpecializedSymbol> m_list;
+            std::pmr::vector<SpecializedSymbol> m_list;
     };
 
     template<ValidSymbol SpecializedSymbol>
@@ -313,6 +979,11 @@ namespace compadre {
             inline bool is_empty() const { return !m_content.has_value(); }
             inline bool is_empty() { return !m_content.has_value(); }
             inline bool has_symbol() { return m_symbol.has_value(); }
+            [[nodiscard]]
+            inline bool is_leaf() const {
+                return !m_left_index.has_value()
+                    && !m_right_index.has_value();
+            }
             inline bool is_leaf() {
                 return !m_left_index.has_value()
                     && !m_right_index.has_value();
@@ -410,17 +1081,110 @@ namespace compadre {
         std::is_base_of_v<CodeTreeNode<typename DerivedTreeNode::content_type, typename DerivedTreeNode::symbol_type>, DerivedTreeNode>;
 
 
+    template <ValidTreeNode CodeTreeNode>
+    class CodeTree;
+
+    // Flat form of a CodeTree, the one walked while coding. Each internal
+    // node is a pair of 16-bit children (left, right); a child with
+    // `leaf_tag` set holds a dense symbol id instead of a node index, so
+    // leaves take no space. The 27 symbols tree fits in 26 * 4 bytes.
+    class PackedCodeTree {
+        public:
+            using NodeRef = uint16_t;
+            using Node = std::array<NodeRef, 2>;
+            static constexpr NodeRef leaf_tag = 0x8000;
+
+        private:
+            std::pmr::vector<Node> m_nodes;
+            // Trees with a single symbol have no internal nodes: the root
+            // is the leaf itself.
+            NodeRef m_root = 0;
+
+            template <ValidTreeNode CodeTreeNode>
+            auto pack_node(const CodeTree<CodeTreeNode>& tree, std::size_t index) -> NodeRef;
+        public:
+            PackedCodeTree() = default;
+            // Empty tree whose nodes go to `resource`.
+            explicit PackedCodeTree(std::pmr::memory_resource* resource)
+                : m_nodes(resource)
+            {
+            }
+            template <ValidTreeNode CodeTreeNode>
+            explicit PackedCodeTree(const CodeTree<CodeTreeNode>& tree,
+                    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+            // Tree of a code given only by its codewords.
+            template <ValidSymbol SpecializedSymbol>
+            explicit PackedCodeTree(const Code<SpecializedSymbol>& code);
+
+            static constexpr bool is_leaf(NodeRef ref) { return (ref & leaf_tag) != 0; }
+            static constexpr auto leaf_of(u8 symb_id) -> NodeRef { return NodeRef(leaf_tag | symb_id); }
+            static constexpr auto symbol_id_of(NodeRef ref) -> u8 { return u8(ref & ~leaf_tag); }
+
+            [[nodiscard]]
+            inline NodeRef root() const { return m_root; }
+            [[nodiscard]]
+            inline NodeRef child(NodeRef node, Bit bit) const { return m_nodes[node][bit]; }
+            [[nodiscard]]
+            inline std::size_t nodes_count() const { return m_nodes.size(); }
+
+            // Room for trees of up to `leaf_count` leaves, so copying one
+            // in does not allocate.
+            inline void reserve(std::size_t leaf_count) { m_nodes.reserve(leaf_count - 1); }
+
+            // Walks the tree from the root with the bits given by
+            // `read_bit` and returns the id of the leaf reached.
+            template <typename BitSource>
+            inline auto decode(BitSource&& read_bit) const -> u8 {
+                auto ref = m_root;
+                while (not is_leaf(ref)) {
+                    ref = m_nodes[ref][read_bit()];
+                }
+                return symbol_id_of(ref);
+            }
+
+            // Same walk over the window of `reader`, consuming the bits
+            // once at the leaf; only codes longer than a refill take a
+            // second one.
+            inline auto decode(BitReader& reader) const -> u8 {
+                reader.refill();
+                auto window = reader.window();
+                auto ref = m_root;
+                std::size_t length = 0;
+                while (not is_leaf(ref)) {
+                    if (length == BitReader::max_peek_bits) [[unlikely]] {
+                        reader.consume(length);
+                        reader.refill();
+                        window = reader.window();
+                        length = 0;
+                    }
+                    ref = m_nodes[ref][(window >> length) & 1];
+                    length++;
+                }
+                reader.consume(length);
+                return symbol_id_of(ref);
+            }
+
+            template <typename SpecializedSymbol>
+            auto get_code_map() const -> Code<SpecializedSymbol>;
+    };
+
     template <ValidTreeNode CodeTreeNode>
     class CodeTree {
         using symbol_type =  CodeTreeNode::symbol_type;
         private:
-            std::vector<CodeTreeNode> m_tree;
+            std::pmr::vector<CodeTreeNode> m_tree;
             Code<symbol_type> m_code;
         public:
             static const Bit left_branch_bit = false;
             static const Bit right_branch_bit = true;
             CodeTree() = default;
             CodeTree(const CodeTreeNode& root);
+            // Takes a node array already linked by index, root at 0.
+            CodeTree(std::pmr::vector<CodeTreeNode> nodes)
+                : m_tree(std::move(nodes))
+            {
+                assert(not m_tree.empty());
+            }
             std::size_t push_node(const CodeTreeNode& node);
             std::size_t add_left_child_to(std::size_t parent_index, const CodeTreeNode& child);
             std::size_t add_right_child_to(std::size_t parent_index, const CodeTreeNode& child);
@@ -431,7 +1195,20 @@ namespace compadre {
                 return m_tree.at(index);
             }
 
-            auto get_index_of_leaves() -> std::vector<std::size_t>;
+            [[nodiscard]]
+            inline const CodeTreeNode& get_node_ref_from_index(std::size_t index) const {
+                assert(index < m_tree.size());
+
+                return m_tree.at(index);
+            }
+
+            // In the same memory as the tree.
+            [[nodiscard]]
+            inline auto pack() const -> PackedCodeTree {
+                return PackedCodeTree(*this, m_tree.get_allocator().resource());
+            }
+
+            auto get_index_of_leaves() -> std::vector<std::size_t>;
 
             inline
             auto root() -> CodeTreeNode {
@@ -443,13 +1220,6 @@ namespace compadre {
                 return m_tree.at(0);
             }
 
-            static
-            auto merge(const CodeTree& left, const CodeTree& right) -> CodeTree;
-
-            static
-            auto greater_than(const CodeTree& left, const CodeTree& right) -> bool;
-
-
 
             //inline auto symbol_from_codeword(CodeWord codeword) {
             //}
@@ -479,15 +1249,6 @@ namespace compadre {
     std::size_t CodeTree<CodeTreeNode>::push_node(const CodeTreeNode& node) {
         assert(not node.is_empty());
 
-        for (auto [node_index, tree_node]: std::views::enumerate(m_tree)) {
-            assert(not tree_node.is_empty());
-            if (tree_node.is_empty()) {
-                tree_node = node;
-                tree_node.m_index = node_index;
-                return node_index;
-            }
-        }
-
         m_tree.push_back(node);
         m_tree.back().m_index = m_tree.size() - 1;
         return m_tree.size() - 1;
@@ -534,41 +1295,109 @@ namespace compadre {
 
     template <ValidTreeNode CodeTreeNode>
     auto CodeTree<CodeTreeNode>::get_code_map() -> Code<symbol_type> {
+        return pack().template get_code_map<symbol_type>();
+    }
 
-        auto code = Code<symbol_type>();
-        auto leaf_nodes_indexes = get_index_of_leaves();
+    template <ValidTreeNode CodeTreeNode>
+    PackedCodeTree::PackedCodeTree(const CodeTree<CodeTreeNode>& tree, std::pmr::memory_resource* resource)
+        : m_nodes(resource)
+    {
+        assert(tree.nodes_count() > 0);
+        assert(tree.nodes_count() / 2 < leaf_tag);
 
-        for (auto node_index: leaf_nodes_indexes) {
-            auto node = get_node_ref_from_index(node_index);
-            auto node_code_word = CodeWord();
-            auto current_node = node;
+        // A full binary tree with n leaves has n - 1 internal nodes.
+        m_nodes.reserve(tree.nodes_count() / 2);
+        m_root = pack_node(tree, 0);
+    }
 
-            while (true) {
-                auto parent_index_opt = current_node.m_parent_index;
-                // We break out of the loop in case we found the root node
-                // (the node doesnt have a parent.
-                if (not parent_index_opt.has_value()) {
-                    break;
-                }
+    template <ValidSymbol SpecializedSymbol>
+    PackedCodeTree::PackedCodeTree(const Code<SpecializedSymbol>& code) {
+        for (std::size_t symb_id = 0; symb_id < code.table_size; symb_id++) {
+            if (not code.has_code(symb_id)) {
+                continue;
+            }
 
-                auto parent_index = parent_index_opt.value();
-                auto parent = get_node_ref_from_index(parent_index);
+            const auto& code_word = code[u8(symb_id)];
+            if (code_word.length == 0) {
+                m_root = leaf_of(u8(symb_id));
+                continue;
+            }
 
-                // Check if the current node its the right os the left child.
-                if (parent.m_left_index.value() == current_node.index().value()) { // NOLINT(bugprone-unchecked-optional-access)
-                    node_code_word.push_left_bit(this->left_branch_bit);
-                }
-                if (parent.m_right_index.value() == current_node.index().value()) { // NOLINT(bugprone-unchecked-optional-access)
-                    node_code_word.push_left_bit(this->right_branch_bit);
-                }
+            if (m_nodes.empty()) {
+                m_nodes.emplace_back();
+            }
 
-                current_node = parent;
+            // Follow the code from the root, adding the missing nodes.
+            NodeRef node = 0;
+            for (std::size_t depth = 0; depth + 1 < code_word.length; depth++) {
+                auto bit = Bit((code_word.bits >> depth) & 1);
+                if (m_nodes[node][bit] == 0) {
+                    assert(m_nodes.size() < leaf_tag);
+                    m_nodes[node][bit] = NodeRef(m_nodes.size());
+                    m_nodes.emplace_back();
+                }
+                node = m_nodes[node][bit];
+                assert(not is_leaf(node));
             }
 
-            assert(node.has_symbol());
-            auto node_symb = node.m_symbol.value(); 
-            //auto node_symb = node.m_symbol.value(); // NOLINT(bugprone-unchecked-optional-access)
-            code.set(node_symb, node_code_word);
+            auto last_bit = Bit((code_word.bits >> (code_word.length - 1)) & 1);
+            m_nodes[node][last_bit] = leaf_of(u8(symb_id));
+        }
+    }
+
+    // Internal nodes are numbered in pre-order, so the root is node 0 and
+    // a left child usually sits right after its parent.
+    template <ValidTreeNode CodeTreeNode>
+    auto PackedCodeTree::pack_node(const CodeTree<CodeTreeNode>& tree, std::size_t index) -> NodeRef {
+        const auto& node = tree.get_node_ref_from_index(index);
+
+        if (node.is_leaf()) {
+            assert(node.symbol().has_value());
+            return leaf_of(symbol_id(node.symbol().value()));
+        }
+
+        auto packed_index = NodeRef(m_nodes.size());
+        m_nodes.emplace_back();
+
+        auto left = pack_node(tree, node.m_left_index.value());
+        auto right = pack_node(tree, node.m_right_index.value());
+        m_nodes[packed_index][CodeTree<CodeTreeNode>::left_branch_bit] = left;
+        m_nodes[packed_index][CodeTree<CodeTreeNode>::right_branch_bit] = right;
+
+        return packed_index;
+    }
+
+    // One top-down pass: the code of each node is its parent's with one
+    // more bit, so no leaf has to climb back to the root.
+    template <typename SpecializedSymbol>
+    auto PackedCodeTree::get_code_map() const -> Code<SpecializedSymbol> {
+        auto code = Code<SpecializedSymbol>();
+
+        if (is_leaf(m_root)) {
+            code.set(symbol_id_of(m_root), CodeWord());
+            return code;
+        }
+
+        // Depth-first: the stack never holds more nodes than the tree
+        // has, and a tree has fewer internal nodes than symbol ids.
+        auto pending = std::array<std::pair<NodeRef, CodeWord>, symbol_table_size>();
+        std::size_t pending_count = 0;
+        pending[pending_count++] = {m_root, CodeWord()};
+
+        while (pending_count > 0) {
+            auto [node, node_code_word] = pending[--pending_count];
+
+            for (auto bit: {false, true}) {
+                auto child_ref = child(node, bit);
+                auto child_code_word = node_code_word.append(bit);
+
+                if (is_leaf(child_ref)) {
+                    code.set(symbol_id_of(child_ref), child_code_word);
+                } else {
+                    assert(pending_count < pending.size());
+                    pending[pending_count++] = {child_ref, child_code_word};
+                }
+            }
         }
 
         return code;
@@ -584,8 +1413,9 @@ namespace compadre {
         using type = typename Algo::symbol_list_type;
     };
 
+    // Algorithms that give every symbol a prefix code (Huffman, Shannon-Fano).
     template <typename Algo, typename SymbolList = SymbolListType<Algo>::type>
-    concept CodingAlgorithm = requires(SymbolList& symb_list) {
+    concept PrefixCodingAlgorithm = requires(SymbolList& symb_list) {
         {
             Algo::encode_symbol_list(symb_list)
         } -> std::same_as<Code<typename SymbolType<Algo>::type>>;
@@ -599,42 +1429,377 @@ namespace compadre {
             typename Algo::symbol_type
     > && std::same_as<SymbolList, typename Algo::symbol_list_type>;
 
+    // Coders of a whole message from the symbol counts, with no code of
+    // their own for each symbol (Tunstall). Only the static and order-0
+    // semi-static models use them. Decoding is empty when the stream is
+    // not one the counts could have coded.
+    template <typename Algo>
+    concept BlockCodingAlgorithm = requires(
+        const Algo& algo,
+        const SymbolCounts& counts,
+        std::span<const u8> symb_ids,
+        BitWriter& outbuff,
+        BitReader& inbuff,
+        std::size_t symb_count
+    ) {
+        typename Algo::symbol_type;
+        typename Algo::symbol_list_type;
+        { Algo(counts) } -> std::same_as<Algo>;
+        { algo.encode(symb_ids, outbuff) } -> std::same_as<void>;
+        { algo.decode(inbuff, symb_count) } -> std::same_as<std::optional<std::vector<u8>>>;
+    };
+
+    // Coders of single binary decisions from the probability of a 1, for
+    // the binary decomposition models.
+    template <typename Algo>
+    concept BinaryCodingAlgorithm = requires(
+        typename Algo::Encoder encoder,
+        typename Algo::Decoder decoder,
+        BitWriter& outbuff,
+        BitReader& inbuff,
+        bool bit,
+        uint32_t probability
+    ) {
+        typename Algo::symbol_type;
+        typename Algo::symbol_list_type;
+        { typename Algo::Encoder(outbuff) };
+        { typename Algo::Decoder(inbuff) };
+        { encoder.encode(bit, probability) } -> std::same_as<void>;
+        { encoder.finish() } -> std::same_as<void>;
+        { decoder.decode(probability) } -> std::same_as<bool>;
+    };
+
+    template <typename Algo>
+    concept CodingAlgorithm = PrefixCodingAlgorithm<Algo> || BlockCodingAlgorithm<Algo> || BinaryCodingAlgorithm<Algo>;
+
+    // The model hands its own lists to the coder, with no copy: the
+    // encoder gets each (symbol, distribution) step through a callback,
+    // and the decoder a reference that lasts until the next update.
     template<typename Model>
     concept AdaptativeModel =
         requires(
             Model model,
             typename Model::symbol_type symb,
-            SymbolList<typename Model::symbol_type> symb_list
+            SymbolList<typename Model::symbol_type> symb_list,
+            void (*code)(const typename Model::symbol_type&, SymbolList<typename Model::symbol_type>&)
         )
     {
-        { model.occurencies_of(symb) } -> std::same_as<
-            std::vector<
-                std::pair<
-                    typename Model::symbol_type,
-                    SymbolList<typename Model::symbol_type>
-                >
-            >
-        >;
+        { model.occurencies_of(symb, code) } -> std::same_as<void>;
         { Model(symb_list) } -> std::same_as<Model>;
-        { model.current_symbols_distribuiton() } -> std::same_as<SymbolList<typename Model::symbol_type>>;
+        { model.current_symbols_distribuiton() } -> std::same_as<SymbolList<typename Model::symbol_type>&>;
         { model.new_symbol_occurency(symb) } -> std::same_as<void>;
     };
 
+    // Counts by position with cumulative counts in O(log n): a Fenwick
+    // tree, where node i (1-based) holds the counts of the positions in
+    // (i - lowbit(i), i]. Positions are only ever appended.
+    class CumulativeCounts {
+        private:
+            std::pmr::vector<uint32_t> m_tree;
+            uint32_t m_total = 0;
+        public:
+            using allocator_type = std::pmr::polymorphic_allocator<uint32_t>;
+
+            CumulativeCounts() = default;
+            explicit CumulativeCounts(const allocator_type& allocator)
+                : m_tree(allocator)
+            {
+            }
+            CumulativeCounts(const CumulativeCounts& other, const allocator_type& allocator)
+                : m_tree(other.m_tree, allocator), m_total(other.m_total)
+            {
+            }
+            CumulativeCounts(CumulativeCounts&& other, const allocator_type& allocator)
+                : m_tree(std::move(other.m_tree), allocator), m_total(other.m_total)
+            {
+            }
+            CumulativeCounts(const CumulativeCounts&) = default;
+            CumulativeCounts(CumulativeCounts&&) noexcept = default;
+            auto operator=(const CumulativeCounts&) -> CumulativeCounts& = default;
+            auto operator=(CumulativeCounts&&) -> CumulativeCounts& = default;
+
+            [[nodiscard]]
+            inline std::size_t size() const { return m_tree.size(); }
+            [[nodiscard]]
+            inline uint32_t total() const { return m_total; }
+
+            // Sum of the counts before `position`.
+            [[nodiscard]]
+            inline uint32_t cumulative(std::size_t position) const {
+                uint32_t sum = 0;
+                for (auto node = position; node > 0; node &= node - 1) {
+                    sum += m_tree[node - 1];
+                }
+                return sum;
+            }
+
+            [[nodiscard]]
+            inline uint32_t count(std::size_t position) const {
+                return cumulative(position + 1) - cumulative(position);
+            }
+
+            inline void push(uint32_t count) {
+                auto node = m_tree.size() + 1;
+                auto covered_begin = node - (node & -node);
+                m_tree.push_back(count + cumulative(node - 1) - cumulative(covered_begin));
+                m_total += count;
+            }
+
+            inline void add(std::size_t position, uint32_t delta) {
+                for (auto node = position + 1; node <= m_tree.size(); node += node & -node) {
+                    m_tree[node - 1] += delta;
+                }
+                m_total += delta;
+            }
+
+            // Position whose cumulative range [low, low + count) holds
+            // `target`, for target < total().
+            [[nodiscard]]
+            inline std::size_t find(uint32_t target) const {
+                assert(target < m_total);
+                std::size_t position = 0;
+                for (auto step = std::bit_floor(m_tree.size()); step > 0; step >>= 1) {
+                    if (position + step <= m_tree.size() && m_tree[position + step - 1] <= target) {
+                        target -= m_tree[position + step - 1];
+                        position += step;
+                    }
+                }
+                return position;
+            }
+
+            // Every count c becomes (c + 1) / 2, so no count drops to 0.
+            void halve();
+    };
+
+    // Serialized starting state of an adaptive model, trained on a
+    // reference text. A file is read whole once; every stream loads its
+    // own model from the bytes. Streams name their snapshot by id(), a
+    // hash of the bytes.
+    class ModelSnapshot {
+        private:
+            std::vector<u8> m_bytes;
+        public:
+            // "PPMS", little-endian.
+            static constexpr uint32_t magic = 0x534D5050;
+
+            explicit ModelSnapshot(std::vector<u8> bytes);
+            // Empty when the file cannot be read.
+            static auto load_file(const std::string& path) -> std::optional<ModelSnapshot>;
+
+            ModelSnapshot(const ModelSnapshot&) = delete;
+            auto operator=(const ModelSnapshot&) -> ModelSnapshot& = delete;
+            ModelSnapshot(ModelSnapshot&&) noexcept = default;
+            auto operator=(ModelSnapshot&&) noexcept -> ModelSnapshot& = default;
+
+            [[nodiscard]]
+            inline auto bytes() const -> std::span<const u8> { return m_bytes; }
+
+            // FNV-1a of the bytes; never 0, which means no snapshot.
+            [[nodiscard]]
+            auto id() const -> uint32_t;
+
+            // Order (MaxK) of the PPM model it holds; empty when the bytes
+            // are not a snapshot.
+            [[nodiscard]]
+            auto order() const -> std::optional<std::size_t>;
+    };
+
+    // Names a distribution of an adaptive model and the version of its
+    // counts: while the key is the same, so is the distribution.
+    struct DistributionKey {
+        uint64_t distribution = 0;
+        uint32_t version = 0;
+
+        bool operator==(const DistributionKey&) const = default;
+    };
+
+    // Adaptive models that tell which distribution the decoder got last,
+    // so that its code can be kept until the version changes.
+    template<typename Model>
+    concept VersionedDistributionModel = AdaptativeModel<Model> &&
+        requires(Model model)
+    {
+        { model.current_distribution_key() } -> std::same_as<DistributionKey>;
+    };
+
+    // Adaptive models that start from a ModelSnapshot and write one.
+    template<typename Model>
+    concept SnapshotModel = AdaptativeModel<Model> &&
+        requires(
+            Model model,
+            SymbolList<typename Model::symbol_type> symb_list,
+            const ModelSnapshot& snapshot,
+            BitWriter& outbuff
+        )
+    {
+        { Model::from_snapshot(symb_list, snapshot) } -> std::same_as<std::optional<Model>>;
+        { model.write_snapshot(outbuff) } -> std::same_as<void>;
+    };
+
+    // Memory of what is built while coding one symbol (the code trees
+    // of its steps), dropped all at once before the next one. A bump
+    // allocator over a block allocated once: the heap is only reached
+    // again by a symbol that needs more than the block.
+    class ScratchArena {
+        private:
+            std::unique_ptr<std::byte[]> m_block;
+            std::pmr::monotonic_buffer_resource m_resource;
+        public:
+            static constexpr std::size_t default_size = std::size_t(1) << 20;
+
+            explicit ScratchArena(std::size_t size = default_size)
+                : m_block(std::make_unique_for_overwrite<std::byte[]>(size)),
+                  m_resource(m_block.get(), size, std::pmr::new_delete_resource())
+            {
+            }
+
+            ScratchArena(const ScratchArena&) = delete;
+            auto operator=(const ScratchArena&) -> ScratchArena& = delete;
+
+            inline auto resource() -> std::pmr::memory_resource* { return &m_resource; }
+
+            // Everything allocated since the last reset is gone.
+            inline void reset() { m_resource.release(); }
+    };
+
+    // Code trees of the distributions an adaptive decoder met, kept until
+    // the version in their key changes. Direct-mapped by distribution over
+    // memory taken once: every tree has room for the whole alphabet, so
+    // storing a new one only copies nodes.
+    class DecodeTreeCache {
+        private:
+            struct Entry {
+                DistributionKey key;
+                bool filled = false;
+                PackedCodeTree tree;
+            };
+
+            std::pmr::monotonic_buffer_resource m_resource;
+            std::vector<Entry> m_entries;
+            std::size_t m_index_bits;
+        public:
+            static constexpr std::size_t default_index_bits = 12;
+
+            explicit DecodeTreeCache(std::size_t index_bits = default_index_bits);
+
+            DecodeTreeCache(const DecodeTreeCache&) = delete;
+            auto operator=(const DecodeTreeCache&) -> DecodeTreeCache& = delete;
+
+            // Tree of `key`, from build_tree() when it is not kept.
+            template <typename BuildTree>
+            auto tree_of(const DistributionKey& key, BuildTree&& build_tree) -> const PackedCodeTree& {
+                auto& entry = m_entries[(key.distribution * 0x9E3779B97F4A7C15u) >> (64 - m_index_bits)];
+                if (not entry.filled || entry.key != key) {
+                    entry.tree = build_tree();
+                    entry.key = key;
+                    entry.filled = true;
+                }
+                return entry.tree;
+            }
+    };
+
     template<ValidSymbol Symbol, std::size_t MaxK>
     class Context {
         private:
             SymbolList<Symbol> m_inner;
             SymbolList<Symbol> m_symbols;
+            // Counts of m_symbols, in the same positions, and the position
+            // of every symbol id in them.
+            CumulativeCounts m_counts;
+            static constexpr u8 no_position = std::numeric_limits<u8>::max();
+            std::array<u8, symbol_table_size> m_positions = filled_positions();
+            // Counts the context is coded with: m_symbols as of the last
+            // refresh, numbered by m_version.
+            SymbolList<Symbol> m_coding_symbols;
+            uint32_t m_coding_total = 0;
+            uint32_t m_version = 0;
+
+            static constexpr auto filled_positions() -> std::array<u8, symbol_table_size> {
+                auto positions = std::array<u8, symbol_table_size>{};
+                positions.fill(no_position);
+                return positions;
+            }
+
+            void halve_counts() {
+                m_counts.halve();
+                for (std::size_t position = 0; position < m_symbols.size(); position++) {
+                    m_symbols.at(position).set_attribute(m_counts.count(position));
+                }
+            }
+
+            // After a new symbol or a halving, or once the total grew by
+            // a 1/refresh_divisor of the coded one. Symbols are only
+            // appended, so both lists keep the same positions.
+            void refresh_coding_symbols_if_due() {
+                auto total = m_counts.total();
+                if (m_coding_symbols.size() != m_symbols.size() || total < m_coding_total
+                        || total >= m_coding_total + std::max(m_coding_total / refresh_divisor, uint32_t(1)))
+                {
+                    refresh_coding_symbols();
+                }
+            }
         public:
+            // All the lists of a context share its memory.
+            using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+            // Bound on the total count of a context: past it every count
+            // is halved.
+            static constexpr uint32_t max_total = uint32_t(1) << 16;
+
+            // The coding counts lag the counts by less than 1/8 of the
+            // total: the code of a busy context stays put for many symbols,
+            // and a decoder can keep it (see DistributionKey).
+            static constexpr uint32_t refresh_divisor = 8;
+
+            // Appends a symbol the context does not have yet.
+            void push_symbol(Symbol symb, uint32_t count) {
+                assert(not contains(symb));
+                symb.set_attribute(count);
+                m_positions[symbol_id(symb)] = u8(m_symbols.size());
+                m_symbols.push(symb);
+                m_counts.push(count);
+            }
+
             Context() = default;
-            Context(SymbolList<Symbol>& ctx_symbols)
-                : m_inner(ctx_symbols)
+            explicit Context(const allocator_type& allocator)
+                : m_inner(allocator), m_symbols(allocator), m_counts(allocator), m_coding_symbols(allocator)
+            {
+            }
+            Context(SymbolList<Symbol>& ctx_symbols, const allocator_type& allocator = {})
+                : m_inner(ctx_symbols, allocator), m_symbols(allocator), m_counts(allocator), m_coding_symbols(allocator)
             {
                 assert(MaxK >= ctx_symbols.size());
             }
+            Context(const Context& other, const allocator_type& allocator)
+                : m_inner(other.m_inner, allocator),
+                  m_symbols(other.m_symbols, allocator),
+                  m_counts(other.m_counts, allocator),
+                  m_positions(other.m_positions),
+                  m_coding_symbols(other.m_coding_symbols, allocator),
+                  m_coding_total(other.m_coding_total),
+                  m_version(other.m_version)
+            {
+            }
+            Context(Context&& other, const allocator_type& allocator)
+                : m_inner(std::move(other.m_inner), allocator),
+                  m_symbols(std::move(other.m_symbols), allocator),
+                  m_counts(std::move(other.m_counts), allocator),
+                  m_positions(other.m_positions),
+                  m_coding_symbols(std::move(other.m_coding_symbols), allocator),
+                  m_coding_total(other.m_coding_total),
+                  m_version(other.m_version)
+            {
+            }
+            Context(const Context&) = default;
+            Context(Context&&) noexcept = default;
+            auto operator=(const Context&) -> Context& = default;
+            auto operator=(Context&&) -> Context& = default;
 
             void clear_symbols() {
                 m_symbols = SymbolList<Symbol>();
+                m_counts = CumulativeCounts();
+                m_positions = filled_positions();
+                refresh_coding_symbols();
             }
 
             void add_symbol(Symbol& symb) {
@@ -647,22 +1812,51 @@ namespace compadre {
                 }
             }
 
-            auto subcontext(std::size_t lenght) -> Context {
-                auto new_inner = SymbolList<Symbol>();
+            // The `lenght` last symbols of this context, with no counts.
+            auto subcontext(std::size_t lenght, const allocator_type& allocator = {}) -> Context {
+                auto new_ctx = Context(allocator);
                 for (auto [inner_index, inner_symbol]: std::views::enumerate(m_inner)) {
                     if (size_t(inner_index) == lenght) {
                         break;
                     }
 
-                    new_inner.push(inner_symbol);
+                    new_ctx.m_inner.push(inner_symbol);
                 }
-                return Context(new_inner);
+                return new_ctx;
+            }
+
+            // Whether this context is `ctx` cut to its own size, i.e.
+            // ctx.subcontext(size()), with no copy.
+            bool is_subcontext_of(Context& ctx) {
+                return size() <= ctx.size()
+                    && std::equal(m_inner.begin(), m_inner.end(), ctx.m_inner.begin());
             }
 
             auto symbols() -> SymbolList<Symbol>& {
                 return m_symbols;
             }
 
+            // Same symbols and positions as symbols(), with the counts
+            // of the last refresh.
+            auto coding_symbols() -> SymbolList<Symbol>& {
+                return m_coding_symbols;
+            }
+
+            [[nodiscard]]
+            inline uint32_t version() const { return m_version; }
+
+            // Copy-assigned, so the list keeps its memory (and arena).
+            void refresh_coding_symbols() {
+                m_coding_symbols = m_symbols;
+                m_coding_total = m_counts.total();
+                m_version++;
+            }
+
+            // Symbols of the context itself, the last one first.
+            auto inner() -> SymbolList<Symbol>& {
+                return m_inner;
+            }
+
             auto as_string() -> std::string {
                 std::string ctx_string{};
 
@@ -683,49 +1877,79 @@ namespace compadre {
                 return m_inner.size();
             }
 
+            [[nodiscard]]
+            auto position_of(const Symbol& symb) const -> std::optional<std::size_t> {
+                auto position = m_positions[symbol_id(symb)];
+                if (position == no_position) {
+                    return std::nullopt;
+                }
+                return position;
+            }
+
+            [[nodiscard]]
+            bool contains(const Symbol& symb) const {
+                return m_positions[symbol_id(symb)] != no_position;
+            }
+
+            // Cumulative range [low, high) of a symbol of the context, out
+            // of total_count().
+            [[nodiscard]]
+            auto cumulative_range(const Symbol& symb) const -> std::pair<uint32_t, uint32_t> {
+                auto position = position_of(symb).value();
+                auto low = m_counts.cumulative(position);
+                return {low, low + m_counts.count(position)};
+            }
+
+            [[nodiscard]]
+            inline uint32_t total_count() const { return m_counts.total(); }
+
+            // Symbol whose cumulative range holds `target`.
+            auto symbol_at(uint32_t target) -> Symbol& {
+                return m_symbols.at(m_counts.find(target));
+            }
+
             void inc_symbol_occurencies(Symbol& symb) {
-                auto symb_index = m_symbols.position_of(symb).value();
+                auto symb_index = position_of(symb).value();
                 auto curr_symb_occur = m_symbols.at(symb_index).attribute().value();
                 m_symbols.at(symb_index).set_attribute(curr_symb_occur+1);
+                m_counts.add(symb_index, 1);
+
+                if (m_counts.total() > max_total) {
+                    halve_counts();
+                }
             }
 
             void add_symbol_occurency(Symbol& symb) {
                 if (m_symbols.size() == 0) {
-                    auto unknown_symb = Symbol();
-                    unknown_symb.set_attribute(0);
-                    m_symbols.push(unknown_symb);
+                    push_symbol(Symbol(), 0);
                 }
 
-                if (m_symbols.contains(symb)) {
+                if (contains(symb)) {
                     inc_symbol_occurencies(symb);
                 } else {
                     // Add new symbol
-                    auto new_symb = symb;
-                    new_symb.set_attribute(1);
-                    m_symbols.push(new_symb);
+                    push_symbol(symb, 1);
                 }
+                refresh_coding_symbols_if_due();
             }
 
             void add_symbol_occurency_and_inc_rho(Symbol& symb) {
                 if (m_symbols.size() == 0) {
-                    auto unknown_symb = Symbol();
-                    unknown_symb.set_attribute(0);
-                    m_symbols.push(unknown_symb);
+                    push_symbol(Symbol(), 0);
                 }
 
-                if (m_symbols.contains(symb)) {
+                if (contains(symb)) {
                     inc_symbol_occurencies(symb);
                 } else {
                     // Inc Rho occurencies
                     auto unknown_symb = Symbol();
-                    assert(m_symbols.contains(unknown_symb));
+                    assert(contains(unknown_symb));
                     inc_symbol_occurencies(unknown_symb);
 
                     // Add new symbol
-                    auto new_symb = symb;
-                    new_symb.set_attribute(1);
-                    m_symbols.push(new_symb);
+                    push_symbol(symb, 1);
                 }
+                refresh_coding_symbols_if_due();
             }
 
             bool operator==(Context& other) {
@@ -750,11 +1974,25 @@ namespace compadre {
 
     template<ValidSymbol Symbol, std::size_t MaxK>
     class PPM {
-        std::array<std::vector<Context<Symbol, MaxK>>, MaxK + 1> m_contexts_lists;
+        // Every context lives as long as the model: they are all taken
+        // from one arena and freed together. Behind a pointer, so the
+        // arena stays put when the model moves.
+        static constexpr std::size_t arena_block_size = std::size_t(1) << 16;
+        std::unique_ptr<std::pmr::monotonic_buffer_resource> m_arena =
+            std::make_unique<std::pmr::monotonic_buffer_resource>(arena_block_size);
+        std::array<std::pmr::vector<Context<Symbol, MaxK>>, MaxK + 1> m_contexts_lists = context_lists(m_arena.get());
         SymbolList<Symbol> m_eq_prob_list;
         SymbolList<Symbol> m_symbols;
         Context<Symbol, MaxK> m_current_ctx;
-        Context<Symbol, MaxK> m_ctx_used_to_decode;
+        // Order of the context that gave the last decoded distribution.
+        std::size_t m_decoding_ctx_size = 0;
+        DistributionKey m_decoding_key;
+
+        static auto context_lists(std::pmr::memory_resource* arena) {
+            return [&]<std::size_t... Order>(std::index_sequence<Order...>) {
+                return std::array{(void(Order), std::pmr::vector<Context<Symbol, MaxK>>(arena))...};
+            }(std::make_index_sequence<MaxK + 1>());
+        }
 
         // Descompressao
         using ContextSize = std::size_t;
@@ -764,10 +2002,6 @@ namespace compadre {
 
         public:
             using symbol_type = Symbol;
-            // Uma lista de pares = (simbolo, lista de simbolos/contadores)
-            using EncodingList = std::vector<std::pair<Symbol, SymbolList<Symbol>>>;
-
-            using ContextualPath = std::vector<std::pair<Symbol, Context<Symbol, MaxK>>>;
 
             PPM(SymbolList<Symbol>& symb_list)
                 : m_current_ctx(), m_last_symbol_and_context()
@@ -779,12 +2013,160 @@ namespace compadre {
                 }
 
                 m_eq_prob_list = m_symbols;
+                // No escape is pending at the start: the decoder may use
+                // the order-0 context at once, if it has one (snapshots).
+                if (m_symbols.size() > 0) {
+                    m_last_symbol_and_context = std::make_pair(m_symbols.front(), 0);
+                }
             }
 
-            static
-            auto find_context(std::vector<Context<Symbol, MaxK>>& ctx_list, Context<Symbol, MaxK> target) -> std::optional<Context<Symbol, MaxK>*> {
-                for (auto& ctx: ctx_list) {
-                    if (ctx == target) {
+            // The contexts point into the arena, which goes along with a
+            // move; assigning over a model would free the memory of its
+            // own lists first.
+            PPM(PPM&&) noexcept = default;
+            auto operator=(PPM&&) -> PPM& = delete;
+
+            // Starting state from `snapshot`, for the same symbol list.
+            // Empty when the bytes are not a snapshot of this model: every
+            // read is checked against their end first.
+            static auto from_snapshot(SymbolList<Symbol>& symb_list, const ModelSnapshot& snapshot) -> std::optional<PPM> {
+                auto bytes = snapshot.bytes();
+                auto inbuff = BitReader(bytes);
+                auto bytes_left = [&]() { return bytes.size() - inbuff.bit_position() / 8; };
+
+                if (bytes_left() < sizeof(uint32_t) + sizeof(uint8_t)
+                        || inbuff.read<uint32_t>() != ModelSnapshot::magic
+                        || inbuff.read<uint8_t>() != MaxK) {
+                    return std::nullopt;
+                }
+
+                // Ids in range, none of them twice.
+                auto read_symbol_ids = [&](std::size_t symb_count, auto&& push) {
+                    auto seen = std::array<bool, symbol_table_size>();
+                    for (std::size_t index = 0; index < symb_count; index++) {
+                        auto symb_id = inbuff.read<uint8_t>();
+                        if (symb_id >= symbol_table_size || seen[symb_id]) {
+                            return false;
+                        }
+                        seen[symb_id] = true;
+                        if (not push(symbol_from_id<Symbol>(symb_id))) {
+                            return false;
+                        }
+                    }
+                    return true;
+                };
+
+                auto read_symbols = [&](SymbolList<Symbol>& list) {
+                    if (bytes_left() < sizeof(uint8_t)) {
+                        return false;
+                    }
+                    auto symb_count = inbuff.read<uint8_t>();
+                    return bytes_left() >= symb_count && read_symbol_ids(symb_count, [&](Symbol symb) {
+                        symb.set_attribute(1);
+                        list.push(symb);
+                        return true;
+                    });
+                };
+
+                auto model = std::optional<PPM>(std::in_place, symb_list);
+                auto symbols = SymbolList<Symbol>();
+                if (not read_symbols(symbols) || not std::ranges::equal(symbols, model->m_symbols)) {
+                    return std::nullopt;
+                }
+                model->m_eq_prob_list = SymbolList<Symbol>();
+                if (not read_symbols(model->m_eq_prob_list)) {
+                    return std::nullopt;
+                }
+
+                for (std::size_t ctx_size = 0; ctx_size <= MaxK; ctx_size++) {
+                    if (bytes_left() < sizeof(uint32_t)) {
+                        return std::nullopt;
+                    }
+                    // Every context takes at least its own symbols and
+                    // their count: a larger count is not in the bytes.
+                    auto ctx_count = inbuff.read<uint32_t>();
+                    if (ctx_count > bytes_left() / (ctx_size + 1)) {
+                        return std::nullopt;
+                    }
+
+                    auto& ctx_list = model->m_contexts_lists[ctx_size];
+                    ctx_list.reserve(ctx_count);
+                    for (uint32_t ctx_index = 0; ctx_index < ctx_count; ctx_index++) {
+                        if (bytes_left() < ctx_size + sizeof(uint8_t)) {
+                            return std::nullopt;
+                        }
+                        auto inner = SymbolList<Symbol>();
+                        for (std::size_t index = 0; index < ctx_size; index++) {
+                            auto symb_id = inbuff.read<uint8_t>();
+                            if (symb_id >= unknown_symbol_id) {
+                                return std::nullopt;
+                            }
+                            inner.push(symbol_from_id<Symbol>(symb_id));
+                        }
+
+                        auto& ctx = ctx_list.emplace_back(inner);
+                        auto symb_count = inbuff.read<uint8_t>();
+                        // Halving keeps the total within max_total.
+                        uint32_t total = 0;
+                        auto pushed = bytes_left() >= symb_count * (sizeof(uint8_t) + sizeof(uint32_t))
+                            && read_symbol_ids(symb_count, [&](Symbol symb) {
+                                auto count = inbuff.read<uint32_t>();
+                                if (count > Context<Symbol, MaxK>::max_total - total) {
+                                    return false;
+                                }
+                                total += count;
+                                ctx.push_symbol(symb, count);
+                                return true;
+                            });
+                        if (not pushed) {
+                            return std::nullopt;
+                        }
+                        ctx.refresh_coding_symbols();
+                    }
+                }
+
+                if (bytes_left() != 0) {
+                    return std::nullopt;
+                }
+                return model;
+            }
+
+            // Contexts and counts, in the form the snapshot constructor
+            // reads. The current context is left out: a stream starts
+            // with none.
+            void write_snapshot(BitWriter& outbuff) {
+                outbuff.write(ModelSnapshot::magic);
+                outbuff.write(uint8_t(MaxK));
+
+                auto write_symbols = [&](SymbolList<Symbol>& list) {
+                    outbuff.write(uint8_t(list.size()));
+                    for (auto& symb: list) {
+                        outbuff.write(symbol_id(symb));
+                    }
+                };
+                write_symbols(m_symbols);
+                write_symbols(m_eq_prob_list);
+
+                for (auto& ctx_list: m_contexts_lists) {
+                    outbuff.write(uint32_t(ctx_list.size()));
+                    for (auto& ctx: ctx_list) {
+                        for (auto& symb: ctx.inner()) {
+                            outbuff.write(symbol_id(symb));
+                        }
+
+                        outbuff.write(uint8_t(ctx.symbols().size()));
+                        for (auto& symb: ctx.symbols()) {
+                            outbuff.write(symbol_id(symb));
+                            outbuff.write(uint32_t(symb.attribute().value()));
+                        }
+                    }
+                }
+            }
+
+            // Context of order `ctx_size` that ends the current one.
+            auto find_context(std::size_t ctx_size) -> std::optional<Context<Symbol, MaxK>*> {
+                for (auto& ctx: m_contexts_lists[ctx_size]) {
+                    if (ctx.is_subcontext_of(m_current_ctx)) {
                         return &ctx;
                     }
                 }
@@ -792,64 +2174,67 @@ namespace compadre {
                 return std::nullopt;
             }
 
-            auto current_symbols_distribuiton() -> SymbolList<Symbol> {
+            // List the next symbol is decoded with: the model's own, valid
+            // until new_symbol_occurency.
+            auto current_symbols_distribuiton() -> SymbolList<Symbol>& {
                 //std::println("\nCurrent symb dist, Ctx={}", m_current_ctx.as_string());
-                for (auto [ctx_size, ctx_list]: std::views::enumerate(m_contexts_lists) | std::views::reverse) {
+                for (auto ctx_size = m_current_ctx.size() + 1; ctx_size-- > 0;) {
 
                     //std::println("K={}", ctx_size);
-                    if (std::size_t(ctx_size) > m_current_ctx.size()) {
-                        continue;
-                    }
-
-                    auto ctx_optional = PPM::find_context(ctx_list, m_current_ctx.subcontext(ctx_size)); 
-                    bool exist_ctx = ctx_optional.has_value();
-
                     auto [last_symbol, last_ctx_size] = m_last_symbol_and_context;
 
-                    if (last_symbol.is_unknown() && last_ctx_size <= size_t(ctx_size)) {
+                    if (last_symbol.is_unknown() && last_ctx_size <= ctx_size) {
                         //std::println("pulou");
                         continue;
                     }
 
+                    auto ctx_optional = find_context(ctx_size);
+                    bool exist_ctx = ctx_optional.has_value();
+
                     if (exist_ctx) {
                         //std::println("achouu");
-                        m_ctx_used_to_decode = m_current_ctx.subcontext(ctx_size);
+                        auto* ctx = ctx_optional.value();
+                        m_decoding_ctx_size = ctx_size;
+                        // Contexts stay in their list for good: the index
+                        // names them.
+                        auto ctx_index = uint64_t(ctx - m_contexts_lists[ctx_size].data());
+                        m_decoding_key = {(ctx_index << 8) | (ctx_size + 1), ctx->version()};
                         //ctx_optional.value()->print();
-                        return ctx_optional.value()->symbols();
+                        return ctx->coding_symbols();
                     }
                 }
 
                 //std::println("Lista EQ");
+                // It only loses symbols, so its size is its version.
+                m_decoding_key = {0, uint32_t(m_eq_prob_list.size())};
                 return m_eq_prob_list;
             }
 
+            // Key of the list current_symbols_distribuiton returned last.
+            [[nodiscard]]
+            auto current_distribution_key() const -> DistributionKey {
+                return m_decoding_key;
+            }
+
             void new_symbol_occurency(Symbol& symbol) {
                 // x atualiza o contexto atual
                 //std::println("\nNew Symb occurenciee,  Ctx={}", m_current_ctx.as_string());
                 //std::println("novo symbol={}", symbol.is_unknown() ? "rho" : std::string(1, symbol.inner().value()));
 
-                for (auto [ctx_size, ctx_list]: std::views::enumerate(m_contexts_lists) | std::views::reverse) {
+                for (auto ctx_size = m_current_ctx.size() + 1; ctx_size-- > 0;) {
 
                     //std::println("K={}", ctx_size);
-                    if (std::size_t(ctx_size) > m_current_ctx.size()) {
-                        continue;
-                    }
-
-                    auto ctx_optional = PPM::find_context(ctx_list, m_current_ctx.subcontext(ctx_size)); 
+                    auto ctx_optional = find_context(ctx_size);
                     bool is_new_ctx = !ctx_optional.has_value() ;
 
 
                     if (is_new_ctx && !symbol.is_unknown()) {
                         //std::println("Ctx novo!");
-
-                        auto new_ctx = m_current_ctx.subcontext(ctx_size);
-                        new_ctx.clear_symbols();
+                        auto& new_ctx = m_contexts_lists[ctx_size].emplace_back(m_current_ctx.subcontext(ctx_size, m_arena.get()));
                         new_ctx.add_symbol_occurency_and_inc_rho(symbol);
-
-                        m_contexts_lists.at(ctx_size).push_back(new_ctx);
                     } else if (!is_new_ctx) {
 
-                        if (symbol.is_unknown() && m_ctx_used_to_decode.size() < size_t(ctx_size)) {
+                        if (symbol.is_unknown() && m_decoding_ctx_size < ctx_size) {
                             continue;
                         }
 
@@ -866,10 +2251,6 @@ namespace compadre {
                         continue;
                     }
 
-                    for (auto pctx: m_contexts_lists.at(ctx_size)) {
-                        //pctx.print();
-                    }
-
                     m_last_symbol_and_context = std::make_pair(symbol, ctx_size);
 
 
@@ -886,83 +2267,25 @@ namespace compadre {
             }
 
 
-            auto find_symbol_context_path(Symbol& symbol) -> ContextualPath {
-                //std::println("FINDD");
-                auto ret = ContextualPath();
-                for (auto [ctx_size, ctx_list]: std::views::enumerate(m_contexts_lists) | std::views::reverse) {
+            void update_contexts(Symbol& symbol) {
+                //std::println("UPDATE CTX");
+                // x atualiza a tabela
 
-                    if (std::size_t(ctx_size) > m_current_ctx.size()) {
-                        continue;
-                    }
+                for (auto ctx_size = m_current_ctx.size() + 1; ctx_size-- > 0;) {
 
-                    if (not ctx_list.empty()) {
-                        //std::println("Ctx atual = {}", ctx_size);
-                    }
-
-                    for (auto& ctx: ctx_list) {
-                        if (m_current_ctx.subcontext(ctx_size) == ctx) {
-                            if (ctx.symbols().contains(symbol)) {
-                                // Add symbol to ContextualPath and return
-                                auto symb_index = ctx.symbols().position_of(symbol).value();
-                                ret.push_back(
-                                    std::make_pair(
-                                        ctx.symbols().at(symb_index),
-                                        ctx
-                                    )
-                                );
-
-                                return ret;
-
-                            } else {
-                                // Add rho to ContextualPath
-                                const auto unknown_symb = Symbol();
-                                auto symb_index = ctx.symbols().position_of(unknown_symb).value();
-                                ret.push_back(
-                                    std::make_pair(
-                                        ctx.symbols().at(symb_index),
-                                        ctx
-                                    )
-                                );
-                            }
-                        }
-                    }
-                }
-
-                return ret;
-            }
-
-            void update_contexts(Symbol& symbol) {
-                //std::println("UPDATE CTX");
-                // x atualiza a tabela
-
-                for (auto [ctx_size, ctx_list]: std::views::enumerate(m_contexts_lists) | std::views::reverse) {
-
-                    //std::println("K={}", ctx_size);
-                    if (std::size_t(ctx_size) > m_current_ctx.size()) {
-                        continue;
-                    }
-
-                    auto ctx_optional = PPM::find_context(ctx_list, m_current_ctx.subcontext(ctx_size)); 
-                    bool is_new_ctx = !ctx_optional.has_value();
+                    //std::println("K={}", ctx_size);
+                    auto ctx_optional = find_context(ctx_size);
+                    bool is_new_ctx = !ctx_optional.has_value();
 
                     if (is_new_ctx) {
                         //std::println("Ctx novo!");
-
-                        auto new_ctx = m_current_ctx.subcontext(ctx_size);
-                        new_ctx.clear_symbols();
+                        auto& new_ctx = m_contexts_lists[ctx_size].emplace_back(m_current_ctx.subcontext(ctx_size, m_arena.get()));
                         new_ctx.add_symbol_occurency_and_inc_rho(symbol);
-
-                        m_contexts_lists.at(ctx_size).push_back(new_ctx);
                     } else {
                         //std::println("Ctx encotrado!");
                         auto ctx_ptr = ctx_optional.value();
                         ctx_ptr->add_symbol_occurency_and_inc_rho(symbol);
                     }
-
-                    for (auto pctx: m_contexts_lists.at(ctx_size)) {
-                        //pctx.print();
-                    }
-
                 }
 
 
@@ -974,49 +2297,38 @@ namespace compadre {
                 m_current_ctx.add_symbol(symbol);
             }
 
-            auto occurencies_of(Symbol& symbol) -> EncodingList {
+            // Calls code(symbol_to_code, distribution) for each step of
+            // `symbol`, from the highest order down: rho in every context
+            // without it, then the symbol. Distributions are the coding
+            // lists of the contexts (see Context::coding_symbols), only
+            // valid during the call. The model is updated after.
+            template <typename CodeFn>
+            void occurencies_of(Symbol& symbol, CodeFn&& code) {
                 //std::println("\nPPM symb={} ctx={}", symbol.inner().value(), m_current_ctx.as_string());
-                auto symb_encoding_list = EncodingList();
                 // x procura pelo symbolo nos contextos em ordem decrescente de tamanho
-                auto ctx_path = find_symbol_context_path(symbol);
-
-                //std::println("Ctx path encontrado: ");
-                for (auto [symb, ctx]: ctx_path) {
-                    symb_encoding_list.push_back(
-                        std::make_pair(
-                            symb,
-                            ctx.symbols()
-                        )
-                    );
-                    //std::println("Symbol = {}", symb.is_unknown() ? "rho" : std::string(1, symb.inner().value()));
-                    //ctx.symbols().print();
-                }
-
-                //std::println("");
+                bool found = false;
+                for (auto ctx_size = m_current_ctx.size() + 1; ctx_size-- > 0 && not found;) {
+                    auto ctx_optional = find_context(ctx_size);
+                    if (not ctx_optional.has_value()) {
+                        continue;
+                    }
 
-                bool need_eq_encoding = false;
-                if (!ctx_path.empty()) {
-                    need_eq_encoding =
-                        ctx_path.back().first.is_unknown()
-                        && ctx_path.back().second.size() == 0;
+                    auto& ctx = *ctx_optional.value();
+                    found = ctx.contains(symbol);
+                    const auto& symb_to_code = found ? symbol : Symbol();
+                    auto& distribution = ctx.coding_symbols();
+                    code(std::as_const(distribution.at(ctx.position_of(symb_to_code).value())), distribution);
                 }
 
-                if (symb_encoding_list.empty() || need_eq_encoding) {
+                // Escaped from every context (or there is none yet).
+                if (not found) {
                     //std::println("Ctx path vazio!");
                     assert(m_eq_prob_list.contains(symbol));
                     auto symb_index = m_eq_prob_list.position_of(symbol).value();
-                    symb_encoding_list.push_back(
-                        std::make_pair(
-                            m_eq_prob_list.at(symb_index),
-                            m_eq_prob_list
-                        )
-                    );
+                    code(std::as_const(m_eq_prob_list.at(symb_index)), m_eq_prob_list);
                 }
 
                 update_contexts(symbol);
-
-                // x retorna a lista de simbolos com os contadores previos à atualização
-                return symb_encoding_list;
             }
 
             void assert_contexts() {
@@ -1028,153 +2340,269 @@ namespace compadre {
             }
     };
 
-        
-    class ShannonFano {
-        public:
-            using symbol_type = SFSymbol;
-            using symbol_list_type = SymbolList<SFTreeNode::symbol_type>;
-            static auto encode_symbol_list(SymbolList<symbol_type>& symb_list) -> Code<symbol_type>;
-            static auto generate_code_tree(SymbolList<symbol_type>& symb_list) -> CodeTree<SFTreeNode>;
+    // Counts of one context of HashedPPM, in a cache line: rho and up to
+    // `capacity` symbols, by id.
+    struct alignas(64) HashedContextSlot {
+        static constexpr std::size_t capacity = 19;
+
+        // Tells apart the contexts that hash to the slot; 0 when free.
+        uint16_t check = 0;
+        u8 size = 0;
+        std::array<u8, capacity> ids{};
+        uint16_t rho_count = 0;
+        std::array<uint16_t, capacity> counts{};
+
+        [[nodiscard]]
+        auto total_count() const -> uint32_t {
+            return std::accumulate(counts.begin(), counts.begin() + size, uint32_t(rho_count));
+        }
     };
+    static_assert(sizeof(HashedContextSlot) == 64);
+
+    // PPM over a hash table of fixed size instead of growing context
+    // lists: `TableMiB` MiB whatever the input, and the context of an
+    // order is found in one pair of adjacent cache lines. The orders
+    // 1..MaxK share the table; the order-0 context is kept exact, so a
+    // symbol seen once is always in some context.
+    //
+    // A context goes to the slot pair of its hash and is told apart by a
+    // 16-bit check. A new context takes a free slot of the pair, or the
+    // one with the smaller total count. Contexts with the same pair and
+    // check share a slot, and a full slot gives the place of its least
+    // frequent symbol to a new one. The encoder and the decoder make the
+    // same moves, so collisions cost compression only.
+    template<ValidSymbol Symbol, std::size_t MaxK, std::size_t TableMiB = 16>
+    class HashedPPM {
+        static_assert(std::has_single_bit(TableMiB), "Slots are indexed by the hash bits.");
+        static constexpr std::size_t slot_count = (TableMiB << 20) / sizeof(HashedContextSlot);
+        static constexpr std::size_t slot_bits = std::countr_zero(slot_count);
+        // Bound on the total count of a slot, so that every count fits
+        // in its 16 bits.
+        static constexpr uint32_t max_total = uint32_t(1) << 15;
+
+        std::vector<HashedContextSlot> m_table = std::vector<HashedContextSlot>(slot_count);
+        Context<Symbol, 0> m_order0;
+        SymbolList<Symbol> m_eq_prob_list;
+        // Last symbol ids, the most recent first.
+        std::array<u8, MaxK> m_history{};
+        std::size_t m_history_size = 0;
+        // Contexts of the next symbol, by order: hashes and slots (null
+        // when not in the table).
+        std::array<uint64_t, MaxK + 1> m_hashes{};
+        std::array<HashedContextSlot*, MaxK + 1> m_slots{};
+        // Decoder: order + 1 of the next context to try; 0 once the
+        // symbol escaped from all of them.
+        std::size_t m_decoding_level = 1;
+        // Distribution of a slot, rebuilt for every step.
+        SymbolList<Symbol> m_distribution;
+
+        static auto pair_index(uint64_t hash) -> std::size_t {
+            return std::size_t(hash >> (64 - slot_bits)) & ~std::size_t(1);
+        }
 
-    using HuffmanSymbol = Symbol<char, uint32_t>;
-    class HuffmanNode : public CodeTreeNode<uint32_t, HuffmanSymbol> {
-        public:
-            using symbol_type = HuffmanSymbol;
-            HuffmanNode(uint32_t counter)
-                : CodeTreeNode(counter)
-            {
-            }
+        static auto check_of(uint64_t hash) -> uint16_t {
+            auto check = uint16_t(hash >> 16);
+            return check == 0 ? 1 : check;
+        }
 
-            HuffmanNode(uint32_t counter, symbol_type symbol)
-                : CodeTreeNode(counter, symbol)
-            {
+        auto find_slot(uint64_t hash) -> HashedContextSlot* {
+            auto index = pair_index(hash);
+            auto check = check_of(hash);
+            for (auto slot_index: {index, index + 1}) {
+                if (m_table[slot_index].check == check) {
+                    return &m_table[slot_index];
+                }
             }
-    };
-
-    // TODO: Write test!!
-    template<>
-    inline
-    auto CodeTree<HuffmanNode>::merge(const CodeTree& left, const CodeTree& right) -> CodeTree
-    {
-        /*
-        auto print_node = [](HuffmanNode node) {
-            auto node_symb = node.symbol().has_value()
-                ?
-                node.symbol().value().is_unknown()
-                    ?
-                    std::string("rho")
-                    :
-                    std::string(1, node.symbol().value().inner().value())
-                :
-                "Branch";
-            std::println("({}\t{}) pai={}, index={}, left={}, right={}",
-                    node_symb, node.get_content().value(),
-                    node.m_parent_index.has_value() ? std::to_string(node.m_parent_index.value()) : std::string("None"),
-                    node.m_index.has_value() ? std::to_string(node.m_index.value()) : std::string("None"),
-                    node.m_left_index.has_value() ? std::to_string(node.m_left_index.value()) : std::string("None"),
-                    node.m_right_index.has_value() ? std::to_string(node.m_right_index.value()) : std::string("None")
-            );
-        };
-        */
+            return nullptr;
+        }
 
-        auto merged = CodeTree();
-        auto left_branch = left;
-        auto right_branch = right;
+        // Slot for a context that is not in the table, taken from the
+        // context with the smaller total count when the pair is full.
+        auto claim_slot(uint64_t hash) -> HashedContextSlot& {
+            auto index = pair_index(hash);
+            auto& first = m_table[index];
+            auto& second = m_table[index + 1];
+            auto& victim = first.check == 0 ? first
+                : second.check == 0 ? second
+                : second.total_count() < first.total_count() ? second : first;
+
+            victim = HashedContextSlot();
+            victim.check = check_of(hash);
+            return victim;
+        }
 
-        auto root_counter = left.root().get_content().value()
-                            + right.root().get_content().value();
-        auto new_root = HuffmanNode(root_counter);
-        auto root_index = merged.push_node(new_root);
-        auto merged_count = merged.nodes_count();
+        static void add_occurency(HashedContextSlot& slot, u8 symb_id) {
+            auto ids_end = slot.ids.begin() + slot.size;
+            auto found = std::find(slot.ids.begin(), ids_end, symb_id);
+            if (found != ids_end) {
+                slot.counts[std::size_t(found - slot.ids.begin())]++;
+            } else {
+                slot.rho_count++;
+                auto position = std::size_t(slot.size);
+                if (slot.size < HashedContextSlot::capacity) {
+                    slot.size++;
+                } else {
+                    position = std::size_t(std::ranges::min_element(slot.counts) - slot.counts.begin());
+                }
+                slot.ids[position] = symb_id;
+                slot.counts[position] = 1;
+            }
 
-        // Left branch
-        //std::println("Left branch");
-        for (auto node: left_branch) {
-            //std::print("Antes\t");
-            //print_node(node);
+            if (slot.total_count() > max_total) {
+                slot.rho_count = uint16_t((slot.rho_count + 1) / 2);
+                for (std::size_t position = 0; position < slot.size; position++) {
+                    slot.counts[position] = uint16_t((slot.counts[position] + 1) / 2);
+                }
+            }
+        }
 
-            if (node.m_parent_index.has_value()) {
-                // Not the root
-                assert(node.m_index.value() != 0);
-                node.m_parent_index = merged_count + node.m_parent_index.value();
+        // Rho first, as in the exact contexts.
+        auto distribution_of(const HashedContextSlot& slot) -> SymbolList<Symbol>& {
+            m_distribution.clear();
+            auto rho = Symbol();
+            rho.set_attribute(slot.rho_count);
+            m_distribution.push(rho);
+            for (std::size_t position = 0; position < slot.size; position++) {
+                auto symb = symbol_from_id<Symbol>(slot.ids[position]);
+                symb.set_attribute(slot.counts[position]);
+                m_distribution.push(symb);
             }
+            return m_distribution;
+        }
 
-            if (node.m_left_index.has_value()) {
-                node.m_left_index = merged_count + node.m_left_index.value();
+        // Context of `order` for the next symbol, if it has any count.
+        auto distribution_at(std::size_t order) -> SymbolList<Symbol>* {
+            if (order == 0) {
+                return m_order0.symbols().size() > 0 ? &m_order0.symbols() : nullptr;
             }
+            return m_slots[order] != nullptr ? &distribution_of(*m_slots[order]) : nullptr;
+        }
 
-            if (node.m_right_index.has_value()) {
-                node.m_right_index = merged_count + node.m_right_index.value();
+        void update_contexts(Symbol& symbol) {
+            m_order0.add_symbol_occurency_and_inc_rho(symbol);
+            auto symb_id = symbol_id(symbol);
+            for (std::size_t order = 1; order <= m_history_size; order++) {
+                // Looked up again: a lower order may have taken the slot.
+                auto* slot = find_slot(m_hashes[order]);
+                add_occurency(slot != nullptr ? *slot : claim_slot(m_hashes[order]), symb_id);
             }
 
-            if (node.m_index.value() == 0) {
-                node.m_parent_index = root_index;
+            if (m_eq_prob_list.contains(symbol)) {
+                m_eq_prob_list.remove(symbol);
             }
 
-            //std::print("Dps\t");
-            //print_node(node);
+            if constexpr (MaxK > 0) {
+                std::shift_right(m_history.begin(), m_history.end(), 1);
+                m_history[0] = symb_id;
+                m_history_size = std::min(m_history_size + 1, MaxK);
+            }
 
-            if (node.m_index.value() == 0) {
-                merged.add_left_child_to(root_index, node);
-            } else {
-                merged.push_node(node);
+            uint64_t hash = 0;
+            for (std::size_t order = 1; order <= m_history_size; order++) {
+                hash = (hash ^ (m_history[order - 1] + 1u)) * 0x9E3779B97F4A7C15u;
+                m_hashes[order] = hash;
+                m_slots[order] = find_slot(hash);
             }
+            m_decoding_level = m_history_size + 1;
         }
 
-        // Update the total number of nodes after the
-        // partial merge
-        merged_count = merged.nodes_count();
+        public:
+            using symbol_type = Symbol;
 
-        // Right branch
-        //std::println("Right branch");
-        for (auto node: right_branch) {
-            //std::print("Antes\t");
-            //print_node(node);
+            static constexpr std::size_t table_bytes = slot_count * sizeof(HashedContextSlot);
 
-            if (node.m_parent_index.has_value()) {
-                // Not the root
-                assert(node.m_index.value() != 0);
-                node.m_parent_index = merged_count + node.m_parent_index.value();
+            HashedPPM(SymbolList<Symbol>& symb_list) {
+                for (auto& symb: symb_list) {
+                    m_eq_prob_list.push(Symbol(symb.inner().value(), 1));
+                }
             }
 
-            if (node.m_left_index.has_value()) {
-                node.m_left_index = merged_count + node.m_left_index.value();
+            // List the next symbol is decoded with, valid until
+            // new_symbol_occurency.
+            auto current_symbols_distribuiton() -> SymbolList<Symbol>& {
+                for (; m_decoding_level > 0; m_decoding_level--) {
+                    auto* distribution = distribution_at(m_decoding_level - 1);
+                    if (distribution != nullptr) {
+                        return *distribution;
+                    }
+                }
+                return m_eq_prob_list;
             }
 
-            if (node.m_right_index.has_value()) {
-                node.m_right_index = merged_count + node.m_right_index.value();
+            void new_symbol_occurency(Symbol& symbol) {
+                if (symbol.is_unknown()) {
+                    assert(m_decoding_level > 0);
+                    m_decoding_level--;
+                    return;
+                }
+                update_contexts(symbol);
             }
 
-            if (node.m_index.value() == 0) {
-                node.m_parent_index = root_index;
+            // Same steps as PPM::occurencies_of: rho in every context
+            // without `symbol`, from the highest order down, then the
+            // symbol. The model is updated after.
+            template <typename CodeFn>
+            void occurencies_of(Symbol& symbol, CodeFn&& code) {
+                bool found = false;
+                for (auto order = m_history_size + 1; order-- > 0 && not found;) {
+                    auto* distribution = distribution_at(order);
+                    if (distribution == nullptr) {
+                        continue;
+                    }
+
+                    auto position = distribution->position_of(symbol);
+                    found = position.has_value();
+                    if (not found) {
+                        position = distribution->position_of(Symbol());
+                    }
+                    code(std::as_const(distribution->at(position.value())), *distribution);
+                }
+
+                if (not found) {
+                    assert(m_eq_prob_list.contains(symbol));
+                    auto symb_index = m_eq_prob_list.position_of(symbol).value();
+                    code(std::as_const(m_eq_prob_list.at(symb_index)), m_eq_prob_list);
+                }
+
+                update_contexts(symbol);
             }
+    };
 
-            //std::print("Dps\t");
-            //print_node(node);
+        
+    class ShannonFano {
+        public:
+            using symbol_type = SFSymbol;
+            using symbol_list_type = SymbolList<SFTreeNode::symbol_type>;
+            static auto encode_symbol_list(SymbolList<symbol_type>& symb_list) -> Code<symbol_type>;
+            static auto generate_code_tree(SymbolList<symbol_type>& symb_list) -> CodeTree<SFTreeNode>;
+    };
 
-            if (node.m_index.value() == 0) {
-                merged.add_right_child_to(root_index, node);
-            } else {
-                merged.push_node(node);
+    using HuffmanSymbol = Symbol<char, uint32_t>;
+    class HuffmanNode : public CodeTreeNode<uint32_t, HuffmanSymbol> {
+        public:
+            using symbol_type = HuffmanSymbol;
+            HuffmanNode(uint32_t counter)
+                : CodeTreeNode(counter)
+            {
             }
-        }
 
-        //std::println("Result!!");
-        /*
-        for (auto node: merged) {
-            print_node(node);
-        }
-        */
+            HuffmanNode(uint32_t counter, symbol_type symbol)
+                : CodeTreeNode(counter, symbol)
+            {
+            }
 
-        return merged;
-    }
+            // Order of the roots during the construction of the tree
+            // (criterio de desempate):
+            //  1. Contador
+            //  2. Ter simbolo (nos internos sao menores)
+            //  3. Simbolo desconhecido (rho) e o maior
+            //  4. Ordem alfabetica
+            static
+            auto greater_than(const HuffmanNode& a, const HuffmanNode& b) -> bool;
+    };
 
-    template<>
     inline
-    auto CodeTree<HuffmanNode>::greater_than(const CodeTree& a_tree, const CodeTree& b_tree) -> bool {
-        auto a = a_tree.root();
-        auto b = b_tree.root();
+    auto HuffmanNode::greater_than(const HuffmanNode& a, const HuffmanNode& b) -> bool {
         auto a_counter = a.get_content().value();
         auto b_counter = b.get_content().value();
 
@@ -1209,224 +2637,1406 @@ namespace compadre {
         public:
             using symbol_type = HuffmanNode::symbol_type;
             using symbol_list_type = SymbolList<HuffmanNode::symbol_type>;
+            // Longer codes are avoided with package-merge, so the static
+            // decoder can always use a DecodeTable.
+            static constexpr std::size_t max_code_length = DecodeTable::width;
+
             static auto encode_symbol_list(SymbolList<symbol_type>& symb_list) -> Code<symbol_type>;
             static auto generate_code_tree(SymbolList<symbol_type>& symb_list) -> CodeTree<HuffmanNode>;
-    };
 
-    struct CompressionInfo {
-        public:
-            double avg_lenght;
-            double entropy;
+            // Same trees and codes with every node in `resource` and no
+            // length limit, which only the decode tables need: for the
+            // adaptive coders, that walk the tree and build one per symbol.
+            static auto encode_symbol_list(SymbolList<symbol_type>& symb_list, std::pmr::memory_resource* resource)
+                -> Code<symbol_type>;
+            static auto generate_code_tree(SymbolList<symbol_type>& symb_list, std::pmr::memory_resource* resource)
+                -> CodeTree<HuffmanNode>;
+
+            // Two-queue construction over `leaf_count` leaves sorted by
+            // increasing weight. Nodes are numbered leaves first, then the
+            // internal nodes as they are created, which is also by weight:
+            // the one of step k is leaf_count + k. merge(k, ultimo,
+            // penultimo) gets its two children, and weight_of(node) must
+            // also know the internal nodes merged so far.
+            template <typename WeightOf, typename Merge>
+            static constexpr void two_queue_merges(std::size_t leaf_count, WeightOf&& weight_of, Merge&& merge);
+
+            // Huffman code lengths for weights sorted increasingly, from
+            // the same merges as generate_code_tree, and limited to
+            // max_code_length the same way.
+            static constexpr auto code_lengths(std::span<const uint64_t> sorted_weights) -> std::vector<uint8_t>;
+
+            // Optimal code lengths under `max_length` (package-merge) for
+            // weights sorted increasingly.
+            static constexpr auto limited_code_lengths(std::span<const uint64_t> sorted_weights, std::size_t max_length)
+                -> std::vector<uint8_t>;
     };
 
-    template <typename T>
-    concept ProbabilityModel = AdaptativeModel<T> || StaticModel<T>;
+    template <typename WeightOf, typename Merge>
+    constexpr void Huffman::two_queue_merges(std::size_t leaf_count, WeightOf&& weight_of, Merge&& merge) {
+        std::size_t next_leaf = 0;
+        std::size_t next_internal = leaf_count;
+        std::size_t internal_end = leaf_count;
 
-    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
-        //requires CodingAlgorithm<CodingAlgo, typename CodingAlgo::symbol_list_type>
-    class Compressor
-    {
-        private:
-            outbit::BitBuffer m_bitbuffer;
-            CompressionInfo m_compression_info;
+        auto pop_smallest = [&]() -> std::size_t {
+            auto has_leaf = next_leaf < leaf_count;
+            auto has_internal = next_internal < internal_end;
 
-            template <StaticModel SModel>
-            auto static_compression(PreprocessedPortugueseText& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
+            // On equal counts the internal node is the smaller one.
+            if (has_internal && (not has_leaf || weight_of(next_internal) <= weight_of(next_leaf))) {
+                return next_internal++;
+            }
 
-            template <StaticModel SModel>
-            auto static_decompression(std::vector<u8>& data, SymbolListType<CodingAlgo>::type& symb_list) -> PreprocessedPortugueseText;
+            assert(has_leaf);
+            return next_leaf++;
+        };
 
-            template <AdaptativeModel AModel>
-            auto adaptative_compression(PreprocessedPortugueseText& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
-            template <AdaptativeModel AModel>
-            auto adaptative_decompression(std::vector<u8>& data, SymbolListType<CodingAlgo>::type& symb_list) -> PreprocessedPortugueseText;
-        public:
-            auto compress_preprocessed_portuguese_text(PreprocessedPortugueseText&) -> std::vector<u8>;
-            auto decompress_preprocessed_portuguese_text(std::vector<u8>&) -> PreprocessedPortugueseText;
+        for (std::size_t step = 0; step + 1 < leaf_count; step++) {
+            auto ultimo = pop_smallest();
+            auto penultimo = pop_smallest();
+            merge(step, ultimo, penultimo);
+            internal_end++;
+        }
+    }
 
-            auto compression_info() -> CompressionInfo {
-                return m_compression_info;
-            }
+    constexpr auto Huffman::code_lengths(std::span<const uint64_t> sorted_weights) -> std::vector<uint8_t> {
+        auto leaf_count = sorted_weights.size();
+        auto lengths = std::vector<uint8_t>(leaf_count, 0);
+        if (leaf_count < 2) {
+            return lengths;
+        }
 
-    };
+        // Node weights and parents in the numbering of two_queue_merges.
+        auto weights = std::vector<uint64_t>(sorted_weights.begin(), sorted_weights.end());
+        weights.reserve(2 * leaf_count - 1);
+        auto parent = std::vector<std::size_t>(2 * leaf_count - 1, 0);
+        two_queue_merges(leaf_count,
+            [&](std::size_t node) { return weights[node]; },
+            [&](std::size_t /*step*/, std::size_t ultimo, std::size_t penultimo) {
+                parent[ultimo] = weights.size();
+                parent[penultimo] = weights.size();
+                weights.push_back(weights[ultimo] + weights[penultimo]);
+            });
 
-    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
-    template <AdaptativeModel AModel>
-    auto Compressor<Model, CodingAlgo>::adaptative_compression(PreprocessedPortugueseText& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
-        auto prob_model = AModel(symb_list);
+        // The root is the last node and parents come after their
+        // children, so the depths come out in a single backward pass.
+        auto depth = std::vector<std::size_t>(weights.size(), 0);
+        std::size_t max_depth = 0;
+        for (auto node = weights.size() - 1; node-- > 0;) {
+            depth[node] = depth[parent[node]] + 1;
+        }
+        for (std::size_t leaf = 0; leaf < leaf_count; leaf++) {
+            lengths[leaf] = uint8_t(depth[leaf]);
+            max_depth = std::max(max_depth, depth[leaf]);
+        }
 
-        // Buffer of compressed data
-        auto outbuff = outbit::BitBuffer();
-        // TODO: Isso precisa ser feitor posteriormente
-        // Write symb count in the first 4 bytes.
-        uint32_t symb_count = 0;
-        outbuff.write(symb_count);
-        std::size_t total_bits{};
-        double entropy = 0.0;
+        if (max_depth > max_code_length) {
+            return limited_code_lengths(sorted_weights, max_code_length);
+        }
 
-        //std::println("adaptativoo");
-        for (char ch: msg.as_string()) {
-            auto symb = typename SymbolType<CodingAlgo>::type(ch);
+        return lengths;
+    }
 
-            auto encoding_list = prob_model.occurencies_of(symb);
+    constexpr auto Huffman::limited_code_lengths(std::span<const uint64_t> sorted_weights, std::size_t max_length)
+        -> std::vector<uint8_t>
+    {
+        auto leaf_count = sorted_weights.size();
+        assert(leaf_count <= (std::size_t(1) << max_length) && "Too many symbols for the code length.");
 
-            for (auto [symb_to_encode, symb_list_to_encode]: encoding_list) {
-                auto code = CodingAlgo::encode_symbol_list(symb_list_to_encode); // Code
+        auto lengths = std::vector<uint8_t>(leaf_count, 0);
+        if (leaf_count < 2) {
+            return lengths;
+        }
 
-                auto code_word = code.get(symb_to_encode).value(); // CodeWord
+        // Package-merge. An item is a leaf or a package of two items of
+        // the previous level; every level merges the leaves with the
+        // packages of the level before, by weight (leaves first on ties).
+        struct Item {
+            uint64_t weight;
+            std::size_t leaf;
+            std::size_t first_child;
+        };
+        constexpr auto no_leaf = std::numeric_limits<std::size_t>::max();
 
-                /*
-                std::string symb_str = symb_to_encode.is_unknown() ? 
-                    "rho" : std::string(1, symb_to_encode.inner().value());
-                std::println("Symb={} Codeword={}",
-                            symb_str,
-                            code_word.m_bits.to_string()
-                        );
-                        */
+        auto leaf_items = std::vector<Item>();
+        leaf_items.reserve(leaf_count);
+        for (std::size_t leaf = 0; leaf < leaf_count; leaf++) {
+            leaf_items.push_back({sorted_weights[leaf], leaf, 0});
+        }
 
+        auto levels = std::vector<std::vector<Item>>{leaf_items};
+        for (std::size_t level = 1; level < max_length; level++) {
+            const auto& previous = levels.back();
+            auto merged = std::vector<Item>();
+            merged.reserve(leaf_count + previous.size() / 2);
+
+            std::size_t next_leaf = 0;
+            std::size_t next_package = 0;
+            while (next_leaf < leaf_count || next_package + 1 < previous.size()) {
+                auto package_weight = next_package + 1 < previous.size()
+                    ? previous[next_package].weight + previous[next_package + 1].weight
+                    : std::numeric_limits<uint64_t>::max();
+
+                if (next_leaf < leaf_count && leaf_items[next_leaf].weight <= package_weight) {
+                    merged.push_back(leaf_items[next_leaf++]);
+                } else {
+                    merged.push_back({package_weight, no_leaf, next_package});
+                    next_package += 2;
+                }
+            }
 
-                // NOTE: We do this to make the decompression easy.
-                code_word.reverse_valid_bits();
-                auto bits_as_ullong = code_word.m_bits.to_ullong();
+            levels.push_back(std::move(merged));
+        }
 
-                outbuff.write_bits(bits_as_ullong, code_word.length());
+        // Every time a leaf shows up in the 2n - 2 cheapest items of the
+        // last level its code gets one bit longer.
+        auto selected = std::vector<std::size_t>(2 * leaf_count - 2);
+        std::iota(selected.begin(), selected.end(), std::size_t(0));
+        for (auto level = levels.size(); level-- > 0;) {
+            auto children = std::vector<std::size_t>();
+            for (auto item_index: selected) {
+                const auto& item = levels[level][item_index];
+                if (item.leaf != no_leaf) {
+                    lengths[item.leaf]++;
+                } else {
+                    children.push_back(item.first_child);
+                    children.push_back(item.first_child + 1);
+                }
+            }
+            selected = std::move(children);
+        }
 
-                symb_count++;
-                total_bits += code_word.length();
+        return lengths;
+    }
 
-                size_t total_occur = 0;
-                for (auto symb: symb_list_to_encode) {
-                    total_occur += symb.attribute().value();
-                }
+    // Canonical Huffman code of a static model over the plain chars (no
+    // word tokens) and its decode table, both computed at compile time.
+    // Same lengths of Huffman::encode_symbol_list, so the runtime path
+    // with a dictionary builds codes of the same form.
+    template<StaticModel SModel>
+    struct StaticHuffmanTables {
+        static constexpr CodeLengths lengths = [] {
+            constexpr auto& chars = PreprocessedPortugueseText::char_list;
+            auto weight_of = [](u8 symb_id) -> uint64_t {
+                return SModel::occurencies_of(symbol_char(symb_id));
+            };
 
-                auto symb_probability = double(symb_to_encode.attribute().value()) / double(total_occur);
-                entropy += std::log2( 1.0 / symb_probability);
+            // Leaves in the order of generate_code_tree: increasing weight
+            // and, on ties, the later char first.
+            auto symb_ids = std::array<u8, chars.size()>{};
+            std::iota(symb_ids.begin(), symb_ids.end(), u8(0));
+            std::ranges::sort(symb_ids, [&](u8 a, u8 b) {
+                return weight_of(a) != weight_of(b) ? weight_of(a) < weight_of(b) : a > b;
+            });
+
+            auto weights = std::vector<uint64_t>();
+            for (auto symb_id: symb_ids) {
+                weights.push_back(weight_of(symb_id));
             }
-        }
 
-        auto ret = outbuff.buffer();
-        std::memcpy(ret.data(), &symb_count, sizeof(uint32_t));
+            auto sorted_lengths = Huffman::code_lengths(weights);
+            auto lengths = CodeLengths{};
+            for (std::size_t leaf = 0; leaf < symb_ids.size(); leaf++) {
+                lengths[symb_ids[leaf]] = sorted_lengths[leaf];
+            }
+            return lengths;
+        }();
 
-        //std::println("total bits = {}", total_bits);
-        //std::println("symb count = {}", symb_count);
-        m_compression_info = CompressionInfo {
-            .avg_lenght = double(total_bits) / double(symb_count),
-            .entropy = entropy / double(symb_count),
-        };
+        static constexpr Code<HuffmanSymbol> code = canonical_code<HuffmanSymbol>(lengths);
+        static constexpr MultiSymbolDecodeTable decode_table = MultiSymbolDecodeTable(code);
+    };
 
-        return ret;
-    }
+    // Variable-to-fixed coding: the message is parsed into strings of a
+    // dictionary built from the symbol counts, and each string is coded
+    // by its fixed-width index. Decoding is an index read and a copy of
+    // the string, with no bit-level search.
+    class Tunstall {
+        public:
+            using symbol_type = Symbol<char, uint32_t>;
+            using symbol_list_type = SymbolList<symbol_type>;
 
-    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
-    template <AdaptativeModel AModel>
-    auto Compressor<Model, CodingAlgo>::adaptative_decompression(std::vector<u8>& data, SymbolListType<CodingAlgo>::type& symb_list) -> PreprocessedPortugueseText {
-        // msg a b r a r
-        // msgcod = a rho b rho r a rho r
-        //
-        // loop: (K = 1)
-            // Recebe arvore do modelo
-            // decodifica simbolo do buffer utilizando a arvore
-            // informa symbolo ao modelo
-            //
-        //std::println("\n\n++++DESCOMPRESSAO+++++\n\n");
-        auto prob_model = AModel(symb_list);
+            static constexpr std::size_t index_bits = 12;
+            static constexpr std::size_t max_strings = std::size_t(1) << index_bits;
+            // Strings are copied whole, so they have a fixed size.
+            static constexpr std::size_t max_string_length = 16;
 
-        // Buffer of compressed data
-        auto inbuff = outbit::BitBuffer();
-        inbuff.read_from_vector(data);
-        auto symb_count = inbuff.read_as<uint32_t>();
-        //std::println("symb count = {}", symb_count);
+            // Dictionary of the symbols with non-zero count.
+            explicit Tunstall(const SymbolCounts& counts);
 
-        auto decompressed_text = std::string();
+            void encode(std::span<const u8> symb_ids, BitWriter& outbuff) const;
+            // Empty when an index is past the strings of the dictionary.
+            auto decode(BitReader& inbuff, std::size_t symb_count) const -> std::optional<std::vector<u8>>;
 
-        for (uint32_t symb_index = 0; symb_index < symb_count; symb_index++) {
-            auto curr_symb_list = prob_model.current_symbols_distribuiton();
-            auto tree = CodingAlgo::generate_code_tree(curr_symb_list);
-
-            // Get the root node
-            auto current_node = tree.get_node_ref_from_index(0);
-            auto code_word = CodeWord();
-            auto symbol = std::optional<typename CodingAlgo::symbol_type>();
-
-            if (tree.nodes_count() > 1) {
-                while (true) {
-                    auto current_bit = inbuff.read_bits_as<bool>(1);
-
-                    if (current_bit) {
-                        assert(decltype(tree)::right_branch_bit);
-                        auto right_index = current_node.m_right_index.value();
-                        current_node = tree.get_node_ref_from_index(right_index);
-                    } else {
-                        assert(!decltype(tree)::left_branch_bit);
-                        auto left_index = current_node.m_left_index.value();
-                        current_node = tree.get_node_ref_from_index(left_index);
+            [[nodiscard]]
+            inline std::size_t strings_count() const { return m_lengths.size(); }
+        private:
+            using NodeRef = uint16_t;
+            static constexpr NodeRef leaf_tag = 0x8000;
+
+            // Parse tree. Each internal node has a child per symbol id; a
+            // child with `leaf_tag` holds the index of a string instead.
+            std::vector<std::array<NodeRef, symbol_table_size>> m_nodes;
+            std::vector<std::array<u8, max_string_length>> m_strings;
+            std::vector<uint8_t> m_lengths;
+            // Any symbol of the dictionary, to finish a string cut by the
+            // end of the message.
+            u8 m_any_symbol = 0;
+    };
+
+    // Range variant of asymmetric numeral systems. The frequencies are
+    // quantized to a power of two, so decoding a symbol is a table
+    // lookup, a multiply and a shift. `States` coders share the stream,
+    // symbol i going to coder i % States, so the decoder runs that many
+    // independent dependency chains.
+    template <std::size_t States = 4>
+    class Rans {
+        static_assert(States >= 2 && States <= 8, "rANS runs 2 to 8 states.");
+        public:
+            using symbol_type = Symbol<char, uint32_t>;
+            using symbol_list_type = SymbolList<symbol_type>;
+
+            static constexpr std::size_t prob_bits = 12;
+            static constexpr uint32_t prob_total = uint32_t(1) << prob_bits;
+            // States stay in [lower_bound, lower_bound << word_bits) and
+            // move to and from the stream a 16-bit word at a time.
+            static constexpr std::size_t word_bits = 16;
+            static constexpr uint32_t lower_bound = uint32_t(1) << 16;
+
+            explicit Rans(const SymbolCounts& counts)
+                : m_freqs(quantized_counts(counts, prob_bits))
+            {
+                uint32_t start = 0;
+                for (std::size_t symb_id = 0; symb_id < symbol_table_size; symb_id++) {
+                    m_starts[symb_id] = start;
+                    for (uint32_t slot = start; slot < start + m_freqs[symb_id]; slot++) {
+                        m_slots[slot] = Slot {
+                            .freq = uint16_t(m_freqs[symb_id]),
+                            .offset = uint16_t(slot - start),
+                            .symb_id = u8(symb_id),
+                        };
                     }
+                    start += m_freqs[symb_id];
+                }
+            }
 
-                    code_word.push_right_bit(current_bit);
+            // Header: the final state of every coder, then the words
+            // in the order the decoder reads them.
+            void encode(std::span<const u8> symb_ids, BitWriter& outbuff) const {
+                if (symb_ids.empty()) {
+                    return;
+                }
 
-                    if (current_node.symbol().has_value()) {
-                        symbol = current_node.symbol().value();
-                        break;
+                // The coders run from the last symbol to the first.
+                auto words = std::vector<uint16_t>();
+                words.reserve(symb_ids.size());
+                auto states = std::array<uint32_t, States>{};
+                states.fill(lower_bound);
+                for (std::size_t index = symb_ids.size(); index-- > 0;) {
+                    auto& state = states[index % States];
+                    auto symb_id = symb_ids[index];
+                    auto freq = m_freqs[symb_id];
+                    assert(freq > 0 && "Symbol without frequency.");
+
+                    auto state_max = (uint64_t(lower_bound >> prob_bits) << word_bits) * freq;
+                    if (state >= state_max) {
+                        words.push_back(uint16_t(state));
+                        state >>= word_bits;
                     }
+                    state = ((state / freq) << prob_bits) + state % freq + m_starts[symb_id];
+                }
+
+                outbuff.reserve_bits(outbuff.bit_count() + States * 32 + words.size() * word_bits);
+                for (auto state: states) {
+                    outbuff.write_bits(state, 32);
+                }
+                for (auto word = words.rbegin(); word != words.rend(); word++) {
+                    outbuff.write_bits(*word, word_bits);
                 }
-            } else {
-                assert (current_node.symbol().has_value());
-                symbol = current_node.symbol().value();
             }
 
-            prob_model.new_symbol_occurency(symbol.value());
+            // Any stream decodes to some symbols.
+            auto decode(BitReader& inbuff, std::size_t symb_count) const -> std::optional<std::vector<u8>> {
+                auto symb_ids = std::vector<u8>(symb_count);
+                if (symb_count == 0) {
+                    return symb_ids;
+                }
 
-            //assert(code.at(symbol.value()).m_bits == code_word.m_bits);
-            decompressed_text += symbol.value().is_unknown() ?
-                "" : std::string(1, symbol.value().inner().value());
-        }
+                auto states = std::array<uint32_t, States>{};
+                for (auto& state: states) {
+                    state = uint32_t(inbuff.read_bits(32));
+                }
 
-        return {decompressed_text};
+                auto decode_symbol = [&](uint32_t& state) {
+                    const auto& slot = m_slots[state & (prob_total - 1)];
+                    state = slot.freq * (state >> prob_bits) + slot.offset;
+                    return slot.symb_id;
+                };
+                // Without a branch: whether a state takes a word is up to
+                // the data, and mispredicting it costs more than the read.
+                // The reader must hold a word.
+                auto renormalize = [&](uint32_t& state) {
+                    auto takes_word = std::size_t(state < lower_bound);
+                    auto word = uint32_t(inbuff.peek(word_bits));
+                    state = takes_word != 0 ? (state << word_bits) | word : state;
+                    inbuff.consume(takes_word * word_bits);
+                };
+                static constexpr std::size_t words_per_refill = BitReader::max_peek_bits / word_bits;
+
+                // One symbol per coder at a time: the lookups first, as
+                // they do not depend on each other, then the reads.
+                std::size_t position = 0;
+                for (; position + States <= symb_count; position += States) {
+                    for (std::size_t coder = 0; coder < States; coder++) {
+                        symb_ids[position + coder] = decode_symbol(states[coder]);
+                    }
+                    for (std::size_t coder = 0; coder < States; coder++) {
+                        if (coder % words_per_refill == 0) {
+                            inbuff.refill();
+                        }
+                        renormalize(states[coder]);
+                    }
+                }
+                for (std::size_t coder = 0; position < symb_count; position++, coder++) {
+                    symb_ids[position] = decode_symbol(states[coder]);
+                    inbuff.refill();
+                    renormalize(states[coder]);
+                }
 
-    }
+                return symb_ids;
+            }
+        private:
+            struct Slot {
+                uint16_t freq;
+                // Position of the slot among the ones of its symbol.
+                uint16_t offset;
+                u8 symb_id;
+            };
 
-    // TODO: usar um tipo generico iterável no lugar de PreprocessedPortugueseText
-    // para a msg
-    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
-    template <StaticModel SModel>
-    auto Compressor<Model, CodingAlgo>::static_compression(PreprocessedPortugueseText& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
+            SymbolCounts m_freqs;
+            std::array<uint32_t, symbol_table_size> m_starts{};
+            std::array<Slot, prob_total> m_slots{};
+    };
 
-        for (auto& symb: symb_list) {
-            symb.set_attribute(SModel::occurencies_of(symb.inner().value()));
-        }
+    // Carry-less binary arithmetic coder. The interval [low, high] is
+    // split in proportion to the probability of a 1 (12 bits), and its
+    // leading bytes go out as soon as both ends agree on them.
+    class BinaryArithmeticCoder {
+        public:
+            using symbol_type = Symbol<char, uint32_t>;
+            using symbol_list_type = SymbolList<symbol_type>;
 
-        auto code = CodingAlgo::encode_symbol_list(symb_list);
-        auto msg_lenght = uint32_t(msg.as_string().size());
-        std::size_t total_bits{};
+            static constexpr std::size_t prob_bits = 12;
 
-        // Buffer of compressed data
-        auto outbuff = outbit::BitBuffer();
-        // Write symb count in the first 4 bytes.
-        outbuff.write(msg_lenght);
-        for (char ch: msg.as_string()) {
-            auto symb = typename SymbolType<CodingAlgo>::type(ch);
+            class Encoder {
+                private:
+                    BitWriter& m_outbuff;
+                    uint32_t m_low = 0;
+                    uint32_t m_high = std::numeric_limits<uint32_t>::max();
+                public:
+                    explicit Encoder(BitWriter& outbuff)
+                        : m_outbuff(outbuff)
+                    {
+                    }
 
-            auto code_word = code.get(symb).value();
-            total_bits += code_word.length();
-            // NOTE: We do this to make the decompression more efficient.
-            code_word.reverse_valid_bits();
-            auto bits_as_ullong = code_word.m_bits.to_ullong();
+                    // `probability` of a 1 is in (0, 2^prob_bits).
+                    inline void encode(bool bit, uint32_t probability) {
+                        assert(probability > 0 && probability < (uint32_t(1) << prob_bits));
+                        auto middle = m_low + uint32_t((uint64_t(m_high - m_low) * probability) >> prob_bits);
+                        if (bit) {
+                            m_high = middle;
+                        } else {
+                            m_low = middle + 1;
+                        }
 
-            outbuff.write_bits(bits_as_ullong, code_word.length());
+                        while (((m_low ^ m_high) >> 24) == 0) {
+                            m_outbuff.write_bits(m_high >> 24, 8);
+                            m_low <<= 8;
+                            m_high = (m_high << 8) | 0xFF;
+                        }
+                    }
+
+                    // Enough of `low` for the decoder to fall in the
+                    // interval.
+                    inline void finish() {
+                        for (std::size_t shift = 32; shift > 0; shift -= 8) {
+                            m_outbuff.write_bits((m_low >> (shift - 8)) & 0xFF, 8);
+                        }
+                    }
+            };
+
+            class Decoder {
+                private:
+                    BitReader& m_inbuff;
+                    uint32_t m_low = 0;
+                    uint32_t m_high = std::numeric_limits<uint32_t>::max();
+                    uint32_t m_value = 0;
+                public:
+                    explicit Decoder(BitReader& inbuff)
+                        : m_inbuff(inbuff)
+                    {
+                        for (std::size_t byte = 0; byte < 4; byte++) {
+                            m_value = (m_value << 8) | uint32_t(m_inbuff.read_bits(8));
+                        }
+                    }
+
+                    inline bool decode(uint32_t probability) {
+                        assert(probability > 0 && probability < (uint32_t(1) << prob_bits));
+                        auto middle = m_low + uint32_t((uint64_t(m_high - m_low) * probability) >> prob_bits);
+                        auto bit = m_value <= middle;
+                        if (bit) {
+                            m_high = middle;
+                        } else {
+                            m_low = middle + 1;
+                        }
+
+                        while (((m_low ^ m_high) >> 24) == 0) {
+                            m_low <<= 8;
+                            m_high = (m_high << 8) | 0xFF;
+                            m_value = (m_value << 8) | uint32_t(m_inbuff.read_bits(8));
+                        }
+
+                        return bit;
+                    }
+            };
+    };
+
+    struct CompressionInfo {
+        public:
+            double avg_lenght;
+            double entropy;
+    };
+
+    // Two-pass model: the symbols are counted first and the code is built
+    // from the counts of the message itself, so it only costs the code
+    // lengths in the header. Order 1 has one code per preceding symbol.
+    template<std::size_t Order>
+    class SemiStatic {
+        public:
+            static constexpr std::size_t order = Order;
+    };
+
+    template<typename Model>
+    concept SemiStaticModel = std::same_as<Model, SemiStatic<Model::order>>;
+
+    // Adaptive counts with a code that is only rebuilt from time to time:
+    // every `period` symbols, or earlier when the symbols coded since the
+    // last rebuild cost 1/8 more than the code's average over the counts
+    // it was built from. Between rebuilds coding is table-driven, as in
+    // the static models.
+    class PeriodicRebuild {
+        public:
+            static constexpr uint32_t default_period = 4096;
+            // Symbols coded with a code before it can be found divergent.
+            static constexpr uint32_t min_divergence_symbols = 256;
+            // Past this total the counts are halved, so old text fades out.
+            static constexpr uint32_t max_total = uint32_t(1) << 16;
+        private:
+            SymbolCounts m_counts{};
+            uint32_t m_total = 0;
+            uint32_t m_period;
+            // Symbols and bits coded since the last rebuild.
+            uint32_t m_coded = 0;
+            uint64_t m_coded_bits = 0;
+            // Cost of the current code over the counts it came from.
+            uint64_t m_expected_bits = 0;
+            uint64_t m_expected_total = 1;
+
+            void halve_counts();
+        public:
+            // Every symbol of `symb_ids` starts with count 1.
+            PeriodicRebuild(std::span<const u8> symb_ids, uint32_t period);
+
+            [[nodiscard]]
+            inline const SymbolCounts& counts() const { return m_counts; }
+
+            // A new code with these lengths was built from counts().
+            void rebuilt(const CodeLengths& lengths);
+
+            // Counts a symbol coded with `length` bits. True when the code
+            // has to be rebuilt.
+            inline bool update(u8 symb_id, std::size_t length) {
+                m_counts[symb_id]++;
+                m_total++;
+                if (m_total > max_total) [[unlikely]] {
+                    halve_counts();
+                }
+
+                m_coded++;
+                m_coded_bits += length;
+                if (m_coded >= m_period) {
+                    return true;
+                }
+
+                // coded_bits / coded > 9/8 * expected_bits / expected_total
+                return m_coded >= min_divergence_symbols
+                    && 8 * m_coded_bits * m_expected_total > 9 * m_expected_bits * m_coded;
+            }
+    };
+
+    template<typename Model>
+    concept PeriodicRebuildModel = std::same_as<Model, PeriodicRebuild>;
+
+    // Logistic domain of the binary models: stretch(p) = ln(p / (1 - p))
+    // and its inverse squash, with p in 12 bits and the logistic values
+    // in 8 fractional bits, clamped to [-max_stretch, max_stretch].
+    inline constexpr int max_stretch = 2047;
+
+    constexpr auto squash(int stretched) -> int {
+        if (stretched > max_stretch) {
+            return 4095;
+        }
+        if (stretched < -max_stretch) {
+            return 1;
+        }
+
+        // 4096 / (1 + e^-x) at x = -8..8 in steps of 1/2, interpolated.
+        constexpr std::array<int, 33> points = {
+            1, 2, 3, 6, 10, 16, 27, 45, 73, 120, 194, 310, 488, 747, 1101, 1546,
+            2047, 2549, 2994, 3348, 3607, 3785, 3901, 3975, 4022, 4050, 4068, 4079,
+            4085, 4089, 4092, 4093, 4094
+        };
+        auto weight = stretched & 127;
+        auto index = (stretched >> 7) + 16;
+        return (points[index] * (128 - weight) + points[index + 1] * weight + 64) >> 7;
+    }
+
+    inline constexpr std::array<int16_t, 4096> stretch_table = []() {
+        auto table = std::array<int16_t, 4096>{};
+        int probability = 0;
+        for (int stretched = -max_stretch; stretched <= max_stretch; stretched++) {
+            auto squashed = squash(stretched);
+            for (; probability <= squashed; probability++) {
+                table[probability] = int16_t(stretched);
+            }
+        }
+        for (; probability < 4096; probability++) {
+            table[probability] = int16_t(max_stretch);
+        }
+        return table;
+    }();
+
+    constexpr auto stretch(uint32_t probability) -> int {
+        return stretch_table[probability];
+    }
+
+    // Binary decomposition: a symbol is the path of `symbol_bits()`
+    // decisions down a fixed binary tree over the symbol list. Each
+    // decision is predicted by one adaptive probability per context
+    // order 0..MaxOrder, looked up by a hash of the preceding symbols and
+    // the tree node, and the predictions are mixed in the logistic domain
+    // by weights learned per node. Adapting is a shift-and-add on each
+    // probability and a step on each weight; there is no list or code
+    // tree to rebuild.
+    template <std::size_t MaxOrder = 2>
+    class BinaryContext {
+        public:
+            static constexpr std::size_t order = MaxOrder;
+            static constexpr std::size_t inputs = MaxOrder + 1;
+            // Probabilities per order.
+            static constexpr std::size_t table_bits = 20;
+            // Probabilities have 16 bits and move 1/2^adapt_shift of the
+            // way to each bit.
+            static constexpr std::size_t adapt_shift = 4;
+            static constexpr std::size_t max_symbol_bits = 7;
+
+            explicit BinaryContext(std::span<const u8> symb_ids)
+                : m_symbol_bits(std::max<std::size_t>(1, std::bit_width(std::max<std::size_t>(symb_ids.size(), 1) - 1))),
+                  m_symbols(symb_ids.begin(), symb_ids.end())
+            {
+                assert(m_symbol_bits <= max_symbol_bits);
+                for (std::size_t code = 0; code < m_symbols.size(); code++) {
+                    m_code_of[m_symbols[code]] = uint32_t(code);
+                }
+
+                for (auto& table: m_probabilities) {
+                    table.assign(std::size_t(1) << table_bits, uint16_t(1) << 15);
+                }
+                for (auto& weights: m_weights) {
+                    weights.fill(int32_t((1 << 16) / inputs));
+                }
+                update_context_hashes();
+            }
+
+            [[nodiscard]]
+            inline std::size_t symbol_bits() const { return m_symbol_bits; }
+
+            // Decisions of a symbol, first one in the top bit.
+            [[nodiscard]]
+            inline uint32_t code_of(u8 symb_id) const { return m_code_of[symb_id]; }
+
+            // Codes past the last symbol only come out of corrupt
+            // streams, and are taken as the last symbol.
+            [[nodiscard]]
+            inline u8 symbol_of(uint32_t code) const {
+                return m_symbols[std::min<std::size_t>(code, m_symbols.size() - 1)];
+            }
+
+            // Probability of a 1 as the next decision, in 12 bits.
+            inline uint32_t predict() {
+                const auto& weights = m_weights[m_node];
+                int64_t dot = 0;
+                for (std::size_t order = 0; order < inputs; order++) {
+                    m_slots[order] = uint32_t(((m_context_hashes[order] + m_node) * 0x9E3779B1u) >> (32 - table_bits));
+                    m_stretched[order] = stretch(m_probabilities[order][m_slots[order]] >> 4);
+                    dot += int64_t(weights[order]) * m_stretched[order];
+                }
+
+                m_prediction = uint32_t(std::clamp(squash(int(dot >> 16)), 1, 4095));
+                return m_prediction;
+            }
+
+            // Learns the decision predicted last and moves down the tree.
+            inline void update(bool bit) {
+                for (std::size_t order = 0; order < inputs; order++) {
+                    auto& probability = m_probabilities[order][m_slots[order]];
+                    if (bit) {
+                        probability = uint16_t(probability + ((0xFFFF - probability) >> adapt_shift));
+                    } else {
+                        probability = uint16_t(probability - (probability >> adapt_shift));
+                    }
+                }
+
+                auto error = ((int32_t(bit) << 12) - int32_t(m_prediction)) * learning_rate;
+                auto& weights = m_weights[m_node];
+                for (std::size_t order = 0; order < inputs; order++) {
+                    weights[order] += (m_stretched[order] * error + (1 << 15)) >> 16;
+                }
+
+                m_node = (m_node << 1) | uint32_t(bit);
+                if (m_node >= (uint32_t(1) << m_symbol_bits)) {
+                    auto symb_id = symbol_of(m_node - (uint32_t(1) << m_symbol_bits));
+                    std::shift_right(m_history.begin(), m_history.end(), 1);
+                    m_history[0] = symb_id;
+                    update_context_hashes();
+                    m_node = 1;
+                }
+            }
+        private:
+            static constexpr int32_t learning_rate = 6;
+
+            std::size_t m_symbol_bits;
+            std::vector<u8> m_symbols;
+            std::array<uint32_t, symbol_table_size> m_code_of{};
+
+            std::array<std::vector<uint16_t>, inputs> m_probabilities;
+            // Mixer weights in 16 fractional bits, per tree node.
+            std::array<std::array<int32_t, inputs>, std::size_t(1) << max_symbol_bits> m_weights;
+
+            // Preceding symbols, the last one first.
+            std::array<u8, std::max<std::size_t>(MaxOrder, 1)> m_history = {};
+            std::array<uint32_t, inputs> m_context_hashes = {};
+            // Node of the next decision, 1 at the root.
+            uint32_t m_node = 1;
+
+            // Lookups of the last prediction, for its update.
+            std::array<uint32_t, inputs> m_slots = {};
+            std::array<int, inputs> m_stretched = {};
+            uint32_t m_prediction = 2048;
+
+            void update_context_hashes() {
+                for (std::size_t order = 0; order < inputs; order++) {
+                    auto hash = uint32_t(order + 1) * 0x2F0B3A49u;
+                    for (std::size_t index = 0; index < order; index++) {
+                        hash = (hash ^ m_history[index]) * 0x9E3779B1u;
+                    }
+                    // Room for the node below the hash.
+                    m_context_hashes[order] = hash << max_symbol_bits;
+                }
+            }
+    };
+
+    template<typename Model>
+    concept BinaryDecompositionModel = std::same_as<Model, BinaryContext<Model::order>>;
+
+    template <typename T>
+    concept ProbabilityModel = AdaptativeModel<T> || StaticModel<T> || SemiStaticModel<T> || PeriodicRebuildModel<T> || BinaryDecompositionModel<T>;
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+        //requires CodingAlgorithm<CodingAlgo, typename CodingAlgo::symbol_list_type>
+    class Compressor
+    {
+        private:
+            outbit::BitBuffer m_bitbuffer;
+            CompressionInfo m_compression_info;
+            DictionaryMode m_dictionary_mode = DictionaryMode::None;
+            std::optional<WordDictionary> m_dictionary;
+            std::size_t m_interleaved_streams = default_interleaved_streams;
+            uint32_t m_rebuild_period = PeriodicRebuild::default_period;
+            const ModelSnapshot* m_snapshot = nullptr;
+
+            auto make_symbol_list() -> SymbolListType<CodingAlgo>::type;
+
+            template <StaticModel SModel>
+            auto occurencies_of(char ch) -> uint32_t;
+
+            // `Message` is any sequence of symbol ids (PackedSymbolBuffer for
+            // plain text) and `Output` any container the ids are pushed into.
+            template <StaticModel SModel, typename Message>
+            auto static_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
+
+            // The decompressions are empty when `data` is not a stream
+            // they could have written.
+            template <StaticModel SModel, typename Output>
+            auto static_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output>;
+
+            // Substream header (count and byte sizes) after what the caller
+            // already wrote to `outbuff`, then the substreams.
+            template <typename Message>
+            auto encode_substreams(const Message& msg, const Code<typename CodingAlgo::symbol_type>& code, BitWriter outbuff) -> std::vector<u8>;
+
+            // One reader per substream; `inbuff` is at the substream header.
+            // Empty when the header does not fit in `data`.
+            static auto read_substreams(std::span<const u8> data, BitReader inbuff) -> std::optional<std::vector<BitReader>>;
+
+            template <typename Output>
+            auto decode_substreams(std::span<const u8> data, BitReader inbuff, uint32_t symb_count, const Code<typename CodingAlgo::symbol_type>& code) -> std::optional<Output>;
+
+            template <typename Output>
+            auto decode_substreams(std::span<const u8> data, BitReader inbuff, uint32_t symb_count, const MultiSymbolDecodeTable& table) -> std::optional<Output>;
+
+            // Counts of the static model SModel, for the block coders.
+            template <StaticModel SModel>
+            auto static_counts(SymbolListType<CodingAlgo>::type& symb_list) -> SymbolCounts {
+                auto counts = SymbolCounts{};
+                for (auto& symb: symb_list) {
+                    counts[symbol_id(symb)] = occurencies_of<SModel>(symb.inner().value());
+                }
+
+                return counts;
+            }
+
+            // Bound on the counts stored by the semi-static block coders.
+            static constexpr uint32_t block_coder_max_total = uint32_t(1) << 16;
+
+            // Lists up to this size are coded by position, with no code
+            // tree: a deterministic context (one symbol and rho).
+            static constexpr std::size_t deterministic_list_size = 2;
+
+            // Context of the first symbol in the order-1 models.
+            static constexpr u8 first_context = symbol_id(' ');
+
+            // Code lengths of CodingAlgo for the symbols with some count.
+            static auto code_lengths_from_counts(const SymbolCounts& counts, SymbolListType<CodingAlgo>::type& symb_list) -> CodeLengths
+                requires PrefixCodingAlgorithm<CodingAlgo>;
+
+            template <SemiStaticModel SSModel, typename Message>
+            auto semi_static_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
+
+            template <SemiStaticModel SSModel, typename Output>
+            auto semi_static_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output>;
+
+            template <PeriodicRebuildModel PRModel, typename Message>
+            auto periodic_rebuild_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
+
+            template <PeriodicRebuildModel PRModel, typename Output>
+            auto periodic_rebuild_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output>;
+
+            template <BinaryDecompositionModel BModel, typename Message>
+            auto binary_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
+
+            template <BinaryDecompositionModel BModel, typename Output>
+            auto binary_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output>;
+
+            // From `snapshot`, when there is one. Empty when the model
+            // cannot start from it.
+            template <AdaptativeModel AModel>
+            auto make_adaptative_model(SymbolListType<CodingAlgo>::type& symb_list, const ModelSnapshot* snapshot) -> std::optional<AModel> {
+                if (snapshot == nullptr) {
+                    return std::optional<AModel>(std::in_place, symb_list);
+                }
+                if constexpr (SnapshotModel<AModel>) {
+                    return AModel::from_snapshot(symb_list, *snapshot);
+                } else {
+                    return std::nullopt;
+                }
+            }
+
+            template <AdaptativeModel AModel, typename Message>
+            auto adaptative_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8>;
+            template <AdaptativeModel AModel, typename Output>
+            auto adaptative_decompression(std::span<const u8> data, AModel prob_model) -> std::optional<Output>;
+        public:
+            static constexpr std::size_t default_interleaved_streams = 4;
+            static constexpr std::size_t max_interleaved_streams = std::numeric_limits<uint8_t>::max();
+
+            auto compress_preprocessed_portuguese_text(PreprocessedPortugueseText&) -> std::vector<u8>;
+            auto decompress_preprocessed_portuguese_text(std::span<const u8>) -> PreprocessedPortugueseText;
+            // Empty when the stream starts from a snapshot other than the
+            // one set, the model cannot start from that one, or the
+            // stream is corrupt.
+            auto try_decompress_preprocessed_portuguese_text(std::span<const u8>) -> std::optional<PreprocessedPortugueseText>;
+
+            // Word-token stage used by the next compressions. The
+            // decompression reads the mode from the stream header.
+            inline void set_dictionary_mode(DictionaryMode mode) {
+                m_dictionary_mode = mode;
+            }
+
+            // Number of substreams of the static models: symbol i goes to
+            // substream i % count, and the decoder runs them in lockstep.
+            // Also read back from the stream header.
+            inline void set_interleaved_streams(std::size_t count) {
+                assert(count > 0 && count <= max_interleaved_streams);
+                m_interleaved_streams = count;
+            }
+
+            // Symbols between code rebuilds of the PeriodicRebuild model.
+            // Also read back from the stream header.
+            inline void set_rebuild_period(uint32_t period) {
+                assert(period > 0);
+                m_rebuild_period = period;
+            }
+
+            // Starting state of the adaptive model, in both directions. It
+            // must outlive the compressor and, to compress, be one the
+            // model starts from; the stream header keeps its id.
+            inline void set_snapshot(const ModelSnapshot* snapshot) {
+                m_snapshot = snapshot;
+            }
+
+            // Snapshot of the adaptive model after `text`, under the
+            // current dictionary mode (the one the streams must use).
+            auto train_snapshot(PreprocessedPortugueseText& text) -> std::vector<u8>
+                requires SnapshotModel<Model>;
+
+            auto compression_info() -> CompressionInfo {
+                return m_compression_info;
+            }
+
+    };
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <AdaptativeModel AModel, typename Message>
+    auto Compressor<Model, CodingAlgo>::adaptative_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
+        static_assert(PrefixCodingAlgorithm<CodingAlgo>, "Adaptive models need a prefix code.");
+        auto loaded_model = make_adaptative_model<AModel>(symb_list, m_snapshot);
+        assert(loaded_model.has_value() && "The model does not start from this snapshot.");
+        auto& prob_model = loaded_model.value();
+
+        // Buffer of compressed data
+        auto outbuff = BitWriter(sizeof(uint32_t) * 8 + msg.size() * 8);
+        // TODO: Isso precisa ser feitor posteriormente
+        // Write symb count in the first 4 bytes.
+        uint32_t symb_count = 0;
+        outbuff.write(symb_count);
+        std::size_t total_bits{};
+        double entropy = 0.0;
+        auto scratch = ScratchArena();
+
+        //std::println("adaptativoo");
+        for (u8 symb_id: msg) {
+            scratch.reset();
+            auto symb = typename SymbolType<CodingAlgo>::type(symbol_char(symb_id));
+
+            prob_model.occurencies_of(symb, [&](const auto& symb_to_encode, auto& symb_list_to_encode) {
+                symb_count++;
+
+                size_t total_occur = 0;
+                for (auto symb: symb_list_to_encode) {
+                    total_occur += symb.attribute().value();
+                }
+
+                auto symb_probability = double(symb_to_encode.attribute().value()) / double(total_occur);
+                entropy += std::log2( 1.0 / symb_probability);
+
+                // A context that has seen a single symbol lists it and
+                // rho; its code is one bit, the position in the list,
+                // with no code built. A lone symbol takes no bit.
+                if (symb_list_to_encode.size() <= deterministic_list_size) {
+                    auto position = symb_list_to_encode.position_of(symb_to_encode).value();
+                    auto length = symb_list_to_encode.size() - 1;
+                    outbuff.write_bits(position, length);
+                    total_bits += length;
+                    return;
+                }
+
+                auto code = CodingAlgo::encode_symbol_list(symb_list_to_encode, scratch.resource());
+                const auto& code_word = code[symbol_id(symb_to_encode)];
+
+                outbuff.write_bits(code_word.bits, code_word.length);
+
+                total_bits += code_word.length;
+            });
+        }
+
+        auto ret = outbuff.finish();
+        std::memcpy(ret.data(), &symb_count, sizeof(uint32_t));
+
+        //std::println("total bits = {}", total_bits);
+        //std::println("symb count = {}", symb_count);
+        m_compression_info = CompressionInfo {
+            .avg_lenght = double(total_bits) / double(symb_count),
+            .entropy = entropy / double(symb_count),
+        };
+
+        return ret;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <AdaptativeModel AModel, typename Output>
+    auto Compressor<Model, CodingAlgo>::adaptative_decompression(std::span<const u8> data, AModel prob_model) -> std::optional<Output> {
+        static_assert(PrefixCodingAlgorithm<CodingAlgo>, "Adaptive models need a prefix code.");
+        // msg a b r a r
+        // msgcod = a rho b rho r a rho r
+        //
+        // loop: (K = 1)
+            // Recebe arvore do modelo
+            // decodifica simbolo do buffer utilizando a arvore
+            // informa symbolo ao modelo
+            //
+        //std::println("\n\n++++DESCOMPRESSAO+++++\n\n");
+
+        // Buffer of compressed data
+        auto inbuff = BitReader(data);
+        auto symb_count = inbuff.read<uint32_t>();
+        //std::println("symb count = {}", symb_count);
+
+        auto decompressed = Output();
+        decompressed.reserve(symb_count);
+        auto scratch = ScratchArena();
+        auto trees = std::optional<DecodeTreeCache>();
+        if constexpr (VersionedDistributionModel<AModel>) {
+            trees.emplace();
+        }
+
+        for (uint32_t symb_index = 0; symb_index < symb_count; symb_index++) {
+            scratch.reset();
+            auto& curr_symb_list = prob_model.current_symbols_distribuiton();
+            auto build_tree = [&]() {
+                return CodingAlgo::generate_code_tree(curr_symb_list, scratch.resource()).pack();
+            };
+
+            // The encoder never codes from an empty distribution, only a
+            // corrupt escape reaches one.
+            if (curr_symb_list.size() == 0) [[unlikely]] {
+                return std::nullopt;
+            }
+
+            u8 symb_id;
+            if (curr_symb_list.size() <= deterministic_list_size) {
+                auto position = inbuff.read_bits(curr_symb_list.size() - 1);
+                symb_id = symbol_id(curr_symb_list.at(position));
+            } else if constexpr (VersionedDistributionModel<AModel>) {
+                symb_id = trees->tree_of(prob_model.current_distribution_key(), build_tree).decode(inbuff);
+            } else {
+                symb_id = build_tree().decode(inbuff);
+            }
+
+            auto symbol = symbol_from_id<typename CodingAlgo::symbol_type>(symb_id);
+            prob_model.new_symbol_occurency(symbol);
+
+            if (symb_id != unknown_symbol_id) {
+                decompressed.push_back(symb_id);
+            }
+        }
+
+        return decompressed;
+
+    }
+
+    // TODO: usar um tipo generico iterável no lugar de PreprocessedPortugueseText
+    // para a msg
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <StaticModel SModel, typename Message>
+    auto Compressor<Model, CodingAlgo>::static_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
+        static_assert(not BinaryCodingAlgorithm<CodingAlgo>, "Binary coders go with the binary decomposition models.");
+
+        auto msg_lenght = uint32_t(msg.size());
+
+        // Header: symb count, then the substreams.
+        auto outbuff = BitWriter();
+        outbuff.write(msg_lenght);
+
+        // Without word tokens the Huffman code is known at compile time.
+        if constexpr (std::same_as<CodingAlgo, Huffman>) {
+            if (not m_dictionary.has_value()) {
+                return encode_substreams(msg, StaticHuffmanTables<SModel>::code, std::move(outbuff));
+            }
+        }
+
+        if constexpr (BlockCodingAlgorithm<CodingAlgo>) {
+            CodingAlgo(static_counts<SModel>(symb_list)).encode(unpack_symbols(msg), outbuff);
+            return outbuff.finish();
+        } else {
+            for (auto& symb: symb_list) {
+                symb.set_attribute(occurencies_of<SModel>(symb.inner().value()));
+            }
+
+            auto code = canonical_code<typename CodingAlgo::symbol_type>(
+                CodingAlgo::encode_symbol_list(symb_list).code_lengths()
+            );
+
+            return encode_substreams(msg, code, std::move(outbuff));
+        }
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <typename Message>
+    auto Compressor<Model, CodingAlgo>::encode_substreams(const Message& msg, const Code<typename CodingAlgo::symbol_type>& code, BitWriter outbuff) -> std::vector<u8> {
+        auto stream_count = m_interleaved_streams;
+
+        // Substream count and the byte size of every substream but the
+        // last one. Substreams follow, byte aligned.
+        outbuff.write(uint8_t(stream_count));
+
+        if (stream_count == 1) {
+            // The headers before are not always whole bytes.
+            outbuff.align_to_byte();
+            // Large enough for the longest code
+            outbuff.reserve_bits(outbuff.bit_count() + msg.size() * code.max_length());
+            for_each_symbol_block(msg, [&](std::span<const u8> symb_ids) {
+                code.encode(symb_ids, outbuff);
+            });
+
+            return outbuff.finish();
+        }
+
+        auto streams = std::vector<BitWriter>();
+        for (std::size_t stream = 0; stream < stream_count; stream++) {
+            streams.emplace_back(msg.size() / stream_count * code.max_length() + code.max_length());
+        }
+
+        std::size_t first = 0;
+        for_each_symbol_block(msg, [&](std::span<const u8> symb_ids) {
+            code.encode_interleaved(symb_ids, streams, first);
+            first += symb_ids.size();
+        });
+
+        auto stream_bytes = std::vector<std::vector<u8>>();
+        for (auto& stream: streams) {
+            stream_bytes.push_back(stream.finish());
+        }
+        for (std::size_t stream = 0; stream + 1 < stream_count; stream++) {
+            assert(stream_bytes[stream].size() <= std::numeric_limits<uint32_t>::max());
+            outbuff.write(uint32_t(stream_bytes[stream].size()));
+        }
+
+        auto ret = outbuff.finish();
+        for (auto& bytes: stream_bytes) {
+            ret.insert(ret.end(), bytes.begin(), bytes.end());
+        }
+
+        return ret;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    auto Compressor<Model, CodingAlgo>::code_lengths_from_counts(const SymbolCounts& counts, SymbolListType<CodingAlgo>::type& symb_list) -> CodeLengths
+        requires PrefixCodingAlgorithm<CodingAlgo>
+    {
+        // The code only covers the symbols that occur.
+        auto occurring = typename CodingAlgo::symbol_list_type();
+        for (auto& symb: symb_list) {
+            auto symb_id = symbol_id(symb);
+            if (counts[symb_id] > 0) {
+                auto occurring_symb = symb;
+                occurring_symb.set_attribute(counts[symb_id]);
+                occurring.push(occurring_symb);
+            }
+        }
+
+        auto lengths = CodeLengths{};
+        if (occurring.size() == 1) {
+            lengths[symbol_id(occurring.front())] = 1;
+        } else if (occurring.size() > 1) {
+            lengths = CodingAlgo::encode_symbol_list(occurring).code_lengths();
+        }
+
+        return lengths;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <SemiStaticModel SSModel, typename Message>
+    auto Compressor<Model, CodingAlgo>::semi_static_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
+        static_assert(not BinaryCodingAlgorithm<CodingAlgo>, "Binary coders go with the binary decomposition models.");
+        static_assert(SSModel::order <= 1, "Semi-static models go up to order 1.");
+
+        auto symb_ids = std::vector<u8>();
+        for (auto& symb: symb_list) {
+            symb_ids.push_back(symbol_id(symb));
+        }
+
+        // Header: symb count and the code lengths, then the codes.
+        auto outbuff = BitWriter();
+        outbuff.write(uint32_t(msg.size()));
+
+        if constexpr (SSModel::order == 0) {
+            // First pass: symbol counts.
+            auto histogram = SymbolHistogram();
+            for_each_symbol_block(msg, [&](std::span<const u8> block) {
+                histogram.add(block);
+            });
+
+            if constexpr (BlockCodingAlgorithm<CodingAlgo>) {
+                auto counts = scaled_counts(histogram.counts(), block_coder_max_total);
+                write_symbol_counts(outbuff, counts, symb_ids);
+                CodingAlgo(counts).encode(unpack_symbols(msg), outbuff);
+                return outbuff.finish();
+            } else {
+                auto lengths = code_lengths_from_counts(histogram.counts(), symb_list);
+                write_code_lengths(outbuff, lengths, symb_ids);
+
+                auto code = canonical_code<typename CodingAlgo::symbol_type>(lengths);
+                return encode_substreams(msg, code, std::move(outbuff));
+            }
+        } else {
+            static_assert(PrefixCodingAlgorithm<CodingAlgo>, "The order-1 model needs a prefix code.");
+
+            // First pass: counts of every symbol after each preceding one.
+            auto counts = std::vector<SymbolCounts>(symbol_table_size);
+            auto previous = first_context;
+            for_each_symbol_block(msg, [&](std::span<const u8> block) {
+                for (auto symb_id: block) {
+                    counts[previous][symb_id]++;
+                    previous = symb_id;
+                }
+            });
+
+            // One code per preceding symbol; a flag tells the contexts
+            // that never occur, which have no code.
+            auto codes = std::vector<Code<typename CodingAlgo::symbol_type>>(symbol_table_size);
+            std::size_t max_length = 0;
+            for (auto context: symb_ids) {
+                auto lengths = code_lengths_from_counts(counts[context], symb_list);
+                auto used = std::ranges::any_of(lengths, [](uint8_t length) { return length > 0; });
+                outbuff.write_bits(used, 1);
+                if (not used) {
+                    continue;
+                }
+
+                write_code_lengths(outbuff, lengths, symb_ids);
+                codes[context] = canonical_code<typename CodingAlgo::symbol_type>(lengths);
+                max_length = std::max(max_length, codes[context].max_length());
+            }
+
+            // Second pass: each symbol with the code of the one before.
+            outbuff.reserve_bits(outbuff.bit_count() + msg.size() * max_length);
+            previous = first_context;
+            for_each_symbol_block(msg, [&](std::span<const u8> block) {
+                for (auto symb_id: block) {
+                    const auto& code_word = codes[previous][symb_id];
+                    outbuff.write_bits(code_word.bits, code_word.length);
+                    previous = symb_id;
+                }
+            });
+
+            return outbuff.finish();
+        }
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <PeriodicRebuildModel PRModel, typename Message>
+    auto Compressor<Model, CodingAlgo>::periodic_rebuild_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
+        static_assert(PrefixCodingAlgorithm<CodingAlgo>, "Periodic-rebuild models need a prefix code.");
+        auto symb_ids = std::vector<u8>();
+        for (auto& symb: symb_list) {
+            symb_ids.push_back(symbol_id(symb));
         }
 
-        // auto bits_per_symb = float(total_bits) / float(msg.as_string().size());
-        //std::println("bits per symb {}", bits_per_symb);
-        //std::println("razao de comp {}", 5.0f / bits_per_symb);
+        auto prob_model = PRModel(symb_ids, m_rebuild_period);
+        auto rebuild_code = [&]() {
+            auto lengths = code_lengths_from_counts(prob_model.counts(), symb_list);
+            prob_model.rebuilt(lengths);
+            return canonical_code<typename CodingAlgo::symbol_type>(lengths);
+        };
+        auto code = rebuild_code();
+
+        // Header: symb count and rebuild period.
+        auto outbuff = BitWriter(2 * sizeof(uint32_t) * 8 + msg.size() * 8);
+        outbuff.write(uint32_t(msg.size()));
+        outbuff.write(m_rebuild_period);
+
+        for_each_symbol_block(msg, [&](std::span<const u8> block) {
+            for (auto symb_id: block) {
+                const auto& code_word = code[symb_id];
+                outbuff.write_bits(code_word.bits, code_word.length);
+                if (prob_model.update(symb_id, code_word.length)) {
+                    code = rebuild_code();
+                }
+            }
+        });
 
-        return outbuff.buffer();
+        return outbuff.finish();
     }
 
     template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
-    auto Compressor<Model, CodingAlgo>::compress_preprocessed_portuguese_text(PreprocessedPortugueseText& text) -> std::vector<u8> {
-        assert(text.as_string().size() < std::size_t(std::numeric_limits<uint32_t>::max)
-                && "Input is too big.");
+    template <PeriodicRebuildModel PRModel, typename Output>
+    auto Compressor<Model, CodingAlgo>::periodic_rebuild_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output> {
+        static_assert(PrefixCodingAlgorithm<CodingAlgo>, "Periodic-rebuild models need a prefix code.");
+        auto symb_ids = std::vector<u8>();
+        for (auto& symb: symb_list) {
+            symb_ids.push_back(symbol_id(symb));
+        }
+
+        auto inbuff = BitReader(data);
+        auto symb_count = inbuff.read<uint32_t>();
+        auto period = inbuff.read<uint32_t>();
+
+        // The decoder follows the code of the encoder: a table while its
+        // codes fit in one, a tree otherwise.
+        auto prob_model = PRModel(symb_ids, period);
+        auto code = Code<typename CodingAlgo::symbol_type>();
+        auto table = std::optional<DecodeTable>();
+        auto tree = PackedCodeTree();
+        auto rebuild_code = [&]() {
+            auto lengths = code_lengths_from_counts(prob_model.counts(), symb_list);
+            prob_model.rebuilt(lengths);
+            code = canonical_code<typename CodingAlgo::symbol_type>(lengths);
+
+            if (code.max_length() <= DecodeTable::width) {
+                table.emplace(code);
+            } else {
+                table.reset();
+                tree = PackedCodeTree(code);
+            }
+        };
+        rebuild_code();
+
+        // One refill covers `per_refill` table decodes; a rebuild starts
+        // over with a refill.
+        static constexpr uint32_t per_refill = BitReader::max_peek_bits / DecodeTable::width;
+        static constexpr uint32_t block_size = 4096;
+        auto block = std::array<u8, block_size>{};
+        uint32_t pending_decodes = 0;
+        uint32_t symb_index = 0;
+
+        auto decompressed = Output();
+        decompressed.reserve(symb_count);
+
+        while (symb_index < symb_count) {
+            auto block_end = std::min(symb_count - symb_index, block_size);
+            for (uint32_t position = 0; position < block_end; position++) {
+                u8 symb_id;
+                if (table.has_value()) {
+                    if (pending_decodes == 0) {
+                        inbuff.refill();
+                        pending_decodes = per_refill;
+                    }
+                    pending_decodes--;
+                    symb_id = table->decode(inbuff);
+                } else {
+                    symb_id = tree.decode(inbuff);
+                }
+
+                block[position] = symb_id;
+                if (prob_model.update(symb_id, code[symb_id].length)) {
+                    rebuild_code();
+                    pending_decodes = 0;
+                }
+            }
+
+            append_symbols(decompressed, std::span(block).first(block_end));
+            symb_index += block_end;
+        }
+
+        return decompressed;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <BinaryDecompositionModel BModel, typename Message>
+    auto Compressor<Model, CodingAlgo>::binary_compression(const Message& msg, SymbolListType<CodingAlgo>::type& symb_list) -> std::vector<u8> {
+        static_assert(BinaryCodingAlgorithm<CodingAlgo>, "Binary decomposition models need a binary coder.");
+
+        auto symb_ids = std::vector<u8>();
+        for (auto& symb: symb_list) {
+            symb_ids.push_back(symbol_id(symb));
+        }
+
+        // Header: symb count, then the coded decisions.
+        auto outbuff = BitWriter(sizeof(uint32_t) * 8 + msg.size() * 8);
+        outbuff.write(uint32_t(msg.size()));
+
+        auto prob_model = BModel(symb_ids);
+        auto encoder = typename CodingAlgo::Encoder(outbuff);
+        auto symbol_bits = prob_model.symbol_bits();
+        for_each_symbol_block(msg, [&](std::span<const u8> block) {
+            for (auto symb_id: block) {
+                auto code = prob_model.code_of(symb_id);
+                for (auto bit_index = symbol_bits; bit_index-- > 0;) {
+                    auto bit = ((code >> bit_index) & 1) != 0;
+                    encoder.encode(bit, prob_model.predict());
+                    prob_model.update(bit);
+                }
+            }
+        });
+        encoder.finish();
+
+        return outbuff.finish();
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <BinaryDecompositionModel BModel, typename Output>
+    auto Compressor<Model, CodingAlgo>::binary_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output> {
+        static_assert(BinaryCodingAlgorithm<CodingAlgo>, "Binary decomposition models need a binary coder.");
+
+        auto symb_ids = std::vector<u8>();
+        for (auto& symb: symb_list) {
+            symb_ids.push_back(symbol_id(symb));
+        }
+
+        auto inbuff = BitReader(data);
+        auto symb_count = inbuff.read<uint32_t>();
+
+        auto decompressed = Output();
+        decompressed.reserve(symb_count);
+        if (symb_count == 0) {
+            return decompressed;
+        }
 
+        auto prob_model = BModel(symb_ids);
+        auto decoder = typename CodingAlgo::Decoder(inbuff);
+        auto symbol_bits = prob_model.symbol_bits();
+        for (uint32_t symb_index = 0; symb_index < symb_count; symb_index++) {
+            uint32_t code = 0;
+            for (std::size_t bit_index = 0; bit_index < symbol_bits; bit_index++) {
+                auto bit = decoder.decode(prob_model.predict());
+                prob_model.update(bit);
+                code = (code << 1) | uint32_t(bit);
+            }
+            decompressed.push_back(prob_model.symbol_of(code));
+        }
+
+        return decompressed;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    auto Compressor<Model, CodingAlgo>::train_snapshot(PreprocessedPortugueseText& text) -> std::vector<u8>
+        requires SnapshotModel<Model>
+    {
+        assert(m_dictionary_mode != DictionaryMode::PerStream
+                && "A per-stream dictionary changes the symbols of every stream.");
+
+        m_dictionary = m_dictionary_mode == DictionaryMode::BuiltIn
+            ? std::optional(WordDictionary::portuguese())
+            : std::nullopt;
+
+        auto symb_list = make_symbol_list();
+        auto loaded_model = make_adaptative_model<Model>(symb_list, m_snapshot);
+        assert(loaded_model.has_value() && "The model does not start from this snapshot.");
+        auto& prob_model = loaded_model.value();
+        auto train = [&](char ch) {
+            auto symb = typename SymbolType<CodingAlgo>::type(ch);
+            prob_model.update_contexts(symb);
+        };
+
+        if (m_dictionary.has_value()) {
+            for (char ch: m_dictionary->tokenize(text.as_string())) {
+                train(ch);
+            }
+        } else {
+            for_each_symbol_block(text.symbols(), [&](std::span<const u8> symb_ids) {
+                for (auto symb_id: symb_ids) {
+                    train(symbol_char(symb_id));
+                }
+            });
+        }
+
+        auto outbuff = BitWriter();
+        prob_model.write_snapshot(outbuff);
+        return outbuff.finish();
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    auto Compressor<Model, CodingAlgo>::make_symbol_list() -> SymbolListType<CodingAlgo>::type {
         auto symb_list = typename CodingAlgo::symbol_list_type();
 
         for (auto ch: PreprocessedPortugueseText::char_list) {
@@ -1434,83 +4044,576 @@ namespace compadre {
             symb_list.push(symb);
         }
 
-        if constexpr (StaticModel<Model>) {
-            return this->static_compression<Model>(text, symb_list);
-        } if constexpr (AdaptativeModel<Model>) {
-            return this->adaptative_compression<Model>(text, symb_list);
+        if (m_dictionary.has_value()) {
+            for (auto token: m_dictionary->tokens()) {
+                auto symb = typename CodingAlgo::symbol_type(token);
+                symb_list.push(symb);
+            }
         }
 
-        static_assert(ProbabilityModel<Model>);
-
+        return symb_list;
     }
 
     template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
     template <StaticModel SModel>
-    auto Compressor<Model, CodingAlgo>::static_decompression(std::vector<u8>& data, SymbolListType<CodingAlgo>::type& symb_list) -> PreprocessedPortugueseText {
-        for (auto& symbol: symb_list) {
-            symbol.set_attribute(SModel::occurencies_of(symbol.inner().value()));
+    auto Compressor<Model, CodingAlgo>::occurencies_of(char ch) -> uint32_t {
+        if (WordDictionary::is_token(ch)) {
+            assert(m_dictionary.has_value());
+            return m_dictionary->occurencies_of(ch);
         }
 
-        auto tree = CodingAlgo::generate_code_tree(symb_list);
-        auto inbuff = outbit::BitBuffer();
-        inbuff.read_from_vector(data);
-        // Write symb count in the first 4 bytes.
-        auto symb_count = inbuff.read_as<uint32_t>();
+        return SModel::occurencies_of(ch);
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    auto Compressor<Model, CodingAlgo>::compress_preprocessed_portuguese_text(PreprocessedPortugueseText& text) -> std::vector<u8> {
+        assert(text.size() < std::size_t(std::numeric_limits<uint32_t>::max())
+                && "Input is too big.");
+
+        // The dictionaries work on chars: unpacked once, and only for them.
+        auto chars = m_dictionary_mode != DictionaryMode::None ? text.as_string() : std::string();
+
+        // Header: dictionary mode followed by the dictionary itself
+        // when it is stored per stream.
+        auto outbuff = BitWriter();
+        outbuff.write(uint8_t(m_dictionary_mode));
+
+        switch (m_dictionary_mode) {
+            case DictionaryMode::None:
+                m_dictionary = std::nullopt;
+                break;
+            case DictionaryMode::BuiltIn:
+                m_dictionary = WordDictionary::portuguese();
+                break;
+            case DictionaryMode::PerStream:
+                m_dictionary = WordDictionary::from_text(chars);
+                m_dictionary->write_to(outbuff);
+                break;
+        }
+
+        // Adaptive models: id of the starting snapshot, 0 for none.
+        if constexpr (AdaptativeModel<Model>) {
+            outbuff.write(m_snapshot != nullptr ? m_snapshot->id() : uint32_t(0));
+        }
+
+        auto symb_list = make_symbol_list();
+        auto compress_message = [&](const auto& msg) {
+            if constexpr (StaticModel<Model>) {
+                return this->static_compression<Model>(msg, symb_list);
+            } else if constexpr (SemiStaticModel<Model>) {
+                return this->semi_static_compression<Model>(msg, symb_list);
+            } else if constexpr (PeriodicRebuildModel<Model>) {
+                return this->periodic_rebuild_compression<Model>(msg, symb_list);
+            } else if constexpr (BinaryDecompositionModel<Model>) {
+                return this->binary_compression<Model>(msg, symb_list);
+            } else {
+                static_assert(AdaptativeModel<Model>);
+                return this->adaptative_compression<Model>(msg, symb_list);
+            }
+        };
+
+        auto payload = std::vector<u8>();
+        if (m_dictionary.has_value()) {
+            // Tokens do not fit in 5 bits, so the tokenized message is
+            // kept as one id per byte.
+            auto tokenized = std::vector<u8>();
+            for (char ch: m_dictionary->tokenize(chars)) {
+                tokenized.push_back(symbol_id(ch));
+            }
+            payload = compress_message(tokenized);
+        } else {
+            payload = compress_message(text.symbols());
+        }
+
+        auto ret = outbuff.finish();
+        ret.insert(ret.end(), payload.begin(), payload.end());
+
+        return ret;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <StaticModel SModel, typename Output>
+    auto Compressor<Model, CodingAlgo>::static_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output> {
+        static_assert(not BinaryCodingAlgorithm<CodingAlgo>, "Binary coders go with the binary decomposition models.");
+        auto inbuff = BitReader(data);
+        // Symb count in the first 4 bytes.
+        auto symb_count = inbuff.read<uint32_t>();
+
+        if constexpr (std::same_as<CodingAlgo, Huffman>) {
+            if (not m_dictionary.has_value()) {
+                return decode_substreams<Output>(data, inbuff, symb_count, StaticHuffmanTables<SModel>::decode_table);
+            }
+        }
+
+        if constexpr (BlockCodingAlgorithm<CodingAlgo>) {
+            auto symb_ids = CodingAlgo(static_counts<SModel>(symb_list)).decode(inbuff, symb_count);
+            if (not symb_ids.has_value()) {
+                return std::nullopt;
+            }
+
+            auto decompressed = Output();
+            append_symbols(decompressed, *symb_ids);
+            return decompressed;
+        } else {
+            for (auto& symbol: symb_list) {
+                symbol.set_attribute(occurencies_of<SModel>(symbol.inner().value()));
+            }
+
+            auto code = canonical_code<typename CodingAlgo::symbol_type>(
+                CodingAlgo::encode_symbol_list(symb_list).code_lengths()
+            );
+
+            return decode_substreams<Output>(data, inbuff, symb_count, code);
+        }
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <SemiStaticModel SSModel, typename Output>
+    auto Compressor<Model, CodingAlgo>::semi_static_decompression(std::span<const u8> data, SymbolListType<CodingAlgo>::type& symb_list) -> std::optional<Output> {
+        static_assert(not BinaryCodingAlgorithm<CodingAlgo>, "Binary coders go with the binary decomposition models.");
+        static_assert(SSModel::order <= 1, "Semi-static models go up to order 1.");
+
+        auto symb_ids = std::vector<u8>();
+        for (auto& symb: symb_list) {
+            symb_ids.push_back(symbol_id(symb));
+        }
+
+        auto inbuff = BitReader(data);
+        auto symb_count = inbuff.read<uint32_t>();
+
+        if constexpr (SSModel::order == 0) {
+            if constexpr (BlockCodingAlgorithm<CodingAlgo>) {
+                auto coder = CodingAlgo(read_symbol_counts(inbuff, symb_ids));
+                auto decoded = coder.decode(inbuff, symb_count);
+                if (not decoded.has_value()) {
+                    return std::nullopt;
+                }
+
+                auto decompressed = Output();
+                append_symbols(decompressed, *decoded);
+                return decompressed;
+            } else {
+                auto lengths = read_code_lengths(inbuff, symb_ids);
+                if (not lengths.has_value()) {
+                    return std::nullopt;
+                }
+
+                auto code = canonical_code<typename CodingAlgo::symbol_type>(*lengths);
+
+                return decode_substreams<Output>(data, inbuff, symb_count, code);
+            }
+        } else {
+            static_assert(PrefixCodingAlgorithm<CodingAlgo>, "The order-1 model needs a prefix code.");
+
+            auto codes = std::vector<Code<typename CodingAlgo::symbol_type>>(symbol_table_size);
+            std::size_t max_length = 0;
+            for (auto context: symb_ids) {
+                if (inbuff.read_bits(1) == 0) {
+                    continue;
+                }
+
+                auto lengths = read_code_lengths(inbuff, symb_ids);
+                if (not lengths.has_value()) {
+                    return std::nullopt;
+                }
+
+                codes[context] = canonical_code<typename CodingAlgo::symbol_type>(*lengths);
+                max_length = std::max(max_length, codes[context].max_length());
+            }
+
+            auto decompressed = Output();
+            decompressed.reserve(symb_count);
+            auto previous = first_context;
+
+            if (max_length > DecodeTable::width) {
+                auto trees = std::vector<std::optional<PackedCodeTree>>(symbol_table_size);
+                for (auto context: symb_ids) {
+                    if (codes[context].max_length() > 0) {
+                        trees[context] = PackedCodeTree(codes[context]);
+                    }
+                }
+
+                for (uint32_t symb_index = 0; symb_index < symb_count; symb_index++) {
+                    if (not trees[previous].has_value()) {
+                        return std::nullopt;
+                    }
+                    previous = trees[previous]->decode(inbuff);
+                    decompressed.push_back(previous);
+                }
+
+                return decompressed;
+            }
+
+            // Only the contexts that occur get a table.
+            auto tables = std::vector<DecodeTable>();
+            tables.reserve(symb_ids.size());
+            auto table_of = std::array<const DecodeTable*, symbol_table_size>{};
+            for (auto context: symb_ids) {
+                if (codes[context].max_length() > 0) {
+                    table_of[context] = &tables.emplace_back(codes[context]);
+                }
+            }
+
+            // A refill covers `per_refill` symbols; the ids reach the
+            // output in blocks. Only a corrupt stream reaches a context
+            // without a code.
+            static constexpr uint32_t per_refill = BitReader::max_peek_bits / DecodeTable::width;
+            static constexpr uint32_t block_size = 4096;
+            auto block = std::array<u8, block_size>{};
+            uint32_t symb_index = 0;
+
+            while (symb_index < symb_count) {
+                auto block_end = std::min(symb_count - symb_index, block_size);
+                uint32_t position = 0;
+                while (position < block_end) {
+                    inbuff.refill();
+                    auto refill_end = std::min(position + per_refill, block_end);
+                    for (; position < refill_end; position++) {
+                        if (table_of[previous] == nullptr) [[unlikely]] {
+                            return std::nullopt;
+                        }
+                        previous = table_of[previous]->decode(inbuff);
+                        block[position] = previous;
+                    }
+                }
+
+                append_symbols(decompressed, std::span(block).first(block_end));
+                symb_index += block_end;
+            }
+
+            return decompressed;
+        }
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    auto Compressor<Model, CodingAlgo>::read_substreams(std::span<const u8> data, BitReader inbuff) -> std::optional<std::vector<BitReader>> {
+        auto stream_count = std::size_t(inbuff.read<uint8_t>());
+        if (stream_count == 0) {
+            return std::nullopt;
+        }
+
+        auto stream_sizes = std::vector<std::size_t>();
+        for (std::size_t stream = 0; stream + 1 < stream_count; stream++) {
+            stream_sizes.push_back(inbuff.read<uint32_t>());
+        }
+
+        // One reader per substream, all starting after the header.
+        auto streams = std::vector<BitReader>();
+        auto stream_begin = (inbuff.bit_position() + 7) / 8;
+        for (std::size_t stream = 0; stream < stream_count; stream++) {
+            if (stream_begin > data.size()) {
+                return std::nullopt;
+            }
+            auto stream_size = stream + 1 < stream_count
+                ? stream_sizes[stream]
+                : data.size() - stream_begin;
+            if (stream_size > data.size() - stream_begin) {
+                return std::nullopt;
+            }
+            streams.emplace_back(data.subspan(stream_begin, stream_size));
+            stream_begin += stream_size;
+        }
+
+        return streams;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <typename Output>
+    auto Compressor<Model, CodingAlgo>::decode_substreams(std::span<const u8> data, BitReader inbuff, uint32_t symb_count, const Code<typename CodingAlgo::symbol_type>& code) -> std::optional<Output> {
+        if (code.max_length() <= MultiSymbolDecodeTable::width) {
+            return decode_substreams<Output>(data, inbuff, symb_count, MultiSymbolDecodeTable(code));
+        }
 
-        auto decompressed_text = std::string();
+        auto streams = read_substreams(data, inbuff);
+        if (not streams.has_value()) {
+            return std::nullopt;
+        }
 
+        auto tree = PackedCodeTree(code);
+        auto decompressed = Output();
+        decompressed.reserve(symb_count);
         for (uint32_t symb_index = 0; symb_index < symb_count; symb_index++) {
-            // Get the root node
-            auto current_node = tree.get_node_ref_from_index(0);
-            auto code_word = CodeWord();
-            auto symbol = std::optional<typename CodingAlgo::symbol_type>();
-
-            while (true) {
-                auto current_bit = inbuff.read_bits_as<bool>(1);
-
-                if (current_bit) {
-                    assert(decltype(tree)::right_branch_bit);
-                    auto right_index = current_node.m_right_index.value();
-                    current_node = tree.get_node_ref_from_index(right_index);
-                } else {
-                    assert(!decltype(tree)::left_branch_bit);
-                    auto left_index = current_node.m_left_index.value();
-                    current_node = tree.get_node_ref_from_index(left_index);
+            decompressed.push_back(tree.decode((*streams)[symb_index % streams->size()]));
+        }
+
+        return decompressed;
+    }
+
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    template <typename Output>
+    auto Compressor<Model, CodingAlgo>::decode_substreams(std::span<const u8> data, BitReader inbuff, uint32_t symb_count, const MultiSymbolDecodeTable& table) -> std::optional<Output> {
+        auto substreams = read_substreams(data, inbuff);
+        if (not substreams.has_value()) {
+            return std::nullopt;
+        }
+
+        auto& streams = *substreams;
+        auto stream_count = streams.size();
+        auto decompressed = Output();
+        decompressed.reserve(symb_count);
+
+        // Substream s holds the symbols s, s + n, s + 2n... Each one is
+        // decoded into its own run of `runs`, several ids per lookup, and
+        // the substreams take turns, so their lookups do not depend on
+        // each other. Every `block_rounds` rounds the runs are
+        // interleaved back. The few symbols a substream decodes past the
+        // block stay at the front of its run.
+        static constexpr std::size_t per_refill = BitReader::max_peek_bits / MultiSymbolDecodeTable::width;
+        static constexpr std::size_t block_rounds = 1024;
+        static constexpr std::size_t run_size = block_rounds + per_refill * MultiSymbolDecodeTable::max_symbols;
+        auto runs = std::vector<u8>(stream_count * run_size);
+        auto decoded = std::vector<std::size_t>(stream_count, 0);
+        auto wanted = std::vector<std::size_t>(stream_count);
+        auto block = std::vector<u8>(stream_count * block_rounds);
+
+        // One refill and the lookups it covers. False when they decode
+        // nothing: the bits start no code, which only happens in a
+        // corrupt stream with an incomplete code.
+        auto decode_refill = [&](std::size_t stream) {
+            auto* run = runs.data() + stream * run_size;
+            auto& reader = streams[stream];
+            auto run_decoded = decoded[stream];
+            reader.refill();
+            for (std::size_t lookup = 0; lookup < per_refill; lookup++) {
+                run_decoded += table.decode(reader, run + run_decoded);
+            }
+            auto progress = run_decoded > decoded[stream];
+            decoded[stream] = run_decoded;
+            return progress;
+        };
+
+        auto all_pending = [&]() {
+            for (std::size_t stream = 0; stream < stream_count; stream++) {
+                if (decoded[stream] >= wanted[stream]) {
+                    return false;
                 }
+            }
+            return true;
+        };
+
+        for (std::size_t first = 0; first < symb_count;) {
+            auto block_size = std::min<std::size_t>(symb_count - first, stream_count * block_rounds);
+            for (std::size_t stream = 0; stream < stream_count; stream++) {
+                wanted[stream] = (block_size + stream_count - 1 - stream) / stream_count;
+            }
 
-                code_word.push_right_bit(current_bit);
+            // Lockstep while every substream still needs a refill, then
+            // each one finishes on its own.
+            while (all_pending()) {
+                for (std::size_t stream = 0; stream < stream_count; stream++) {
+                    if (not decode_refill(stream)) {
+                        return std::nullopt;
+                    }
+                }
+            }
+            for (std::size_t stream = 0; stream < stream_count; stream++) {
+                while (decoded[stream] < wanted[stream]) {
+                    if (not decode_refill(stream)) {
+                        return std::nullopt;
+                    }
+                }
+            }
 
-                if (current_node.symbol().has_value()) {
-                    symbol = current_node.symbol().value();
-                    break;
+            // A single run is already in message order.
+            if (stream_count == 1) {
+                append_symbols(decompressed, std::span(runs).first(block_size));
+            } else {
+                for (std::size_t stream = 0; stream < stream_count; stream++) {
+                    auto* run = runs.data() + stream * run_size;
+                    for (std::size_t round = 0; round < wanted[stream]; round++) {
+                        block[round * stream_count + stream] = run[round];
+                    }
                 }
+                append_symbols(decompressed, std::span(block).first(block_size));
             }
 
-            //assert(code.at(symbol.value()).m_bits == code_word.m_bits);
-            decompressed_text += symbol.value().inner().value();
+            for (std::size_t stream = 0; stream < stream_count; stream++) {
+                auto* run = runs.data() + stream * run_size;
+                std::copy(run + wanted[stream], run + decoded[stream], run);
+                decoded[stream] -= wanted[stream];
+            }
+            first += block_size;
         }
 
-        return {decompressed_text};
+        return decompressed;
     }
 
     template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
-    auto Compressor<Model, CodingAlgo>::decompress_preprocessed_portuguese_text(std::vector<u8>& data) -> PreprocessedPortugueseText {
+    auto Compressor<Model, CodingAlgo>::decompress_preprocessed_portuguese_text(std::span<const u8> data) -> PreprocessedPortugueseText {
+        auto text = try_decompress_preprocessed_portuguese_text(data);
+        assert(text.has_value() && "The stream is corrupt or starts from another snapshot.");
+        return std::move(text).value();
+    }
 
-        auto symb_list = typename SymbolListType<CodingAlgo>::type();
+    template <ProbabilityModel Model, CodingAlgorithm CodingAlgo>
+    auto Compressor<Model, CodingAlgo>::try_decompress_preprocessed_portuguese_text(std::span<const u8> data) -> std::optional<PreprocessedPortugueseText> {
 
-        for (auto ch: PreprocessedPortugueseText::char_list) {
-            auto symb = typename SymbolType<CodingAlgo>::type(ch);
-            symb_list.push(symb);
+        auto inbuff = BitReader(data);
+        auto dictionary_mode = DictionaryMode(inbuff.read<uint8_t>());
+        std::size_t header_size = sizeof(uint8_t);
+
+        switch (dictionary_mode) {
+            case DictionaryMode::None:
+                m_dictionary = std::nullopt;
+                break;
+            case DictionaryMode::BuiltIn:
+                m_dictionary = WordDictionary::portuguese();
+                break;
+            case DictionaryMode::PerStream:
+                m_dictionary = WordDictionary::read_from(inbuff);
+                if (not m_dictionary.has_value()) {
+                    return std::nullopt;
+                }
+                header_size += m_dictionary->serialized_size();
+                break;
+            default:
+                return std::nullopt;
+        }
+
+        // Adaptive models: the snapshot the stream starts from, if any.
+        const ModelSnapshot* snapshot = nullptr;
+        if constexpr (AdaptativeModel<Model>) {
+            auto snapshot_id = inbuff.read<uint32_t>();
+            header_size += sizeof(uint32_t);
+            if (snapshot_id != 0) {
+                if (m_snapshot == nullptr || m_snapshot->id() != snapshot_id) {
+                    return std::nullopt;
+                }
+                snapshot = m_snapshot;
+            }
+        }
+
+        auto symb_list = make_symbol_list();
+        // Loaded before decoding, as the snapshot may not fit the model.
+        auto adaptative_model = [&]() -> std::optional<Model> {
+            if constexpr (AdaptativeModel<Model>) {
+                return make_adaptative_model<Model>(symb_list, snapshot);
+            } else {
+                return std::nullopt;
+            }
+        }();
+        if (AdaptativeModel<Model> && not adaptative_model.has_value()) {
+            return std::nullopt;
+        }
+
+        auto payload = data.subspan(header_size);
+        auto decompress_message = [&]<typename Output>() {
+            if constexpr (StaticModel<Model>) {
+                return this->static_decompression<Model, Output>(payload, symb_list);
+            } else if constexpr (SemiStaticModel<Model>) {
+                return this->semi_static_decompression<Model, Output>(payload, symb_list);
+            } else if constexpr (PeriodicRebuildModel<Model>) {
+                return this->periodic_rebuild_decompression<Model, Output>(payload, symb_list);
+            } else if constexpr (BinaryDecompositionModel<Model>) {
+                return this->binary_decompression<Model, Output>(payload, symb_list);
+            } else {
+                static_assert(AdaptativeModel<Model>);
+                return this->adaptative_decompression<Model, Output>(payload, std::move(adaptative_model).value());
+            }
+        };
+
+        if (m_dictionary.has_value()) {
+            auto symb_ids = decompress_message.template operator()<std::vector<u8>>();
+            if (not symb_ids.has_value()) {
+                return std::nullopt;
+            }
+
+            auto tokenized = std::string();
+            for (u8 symb_id: *symb_ids) {
+                tokenized += symbol_char(symb_id);
+            }
+            return PreprocessedPortugueseText::from_preprocessed(m_dictionary->detokenize(tokenized));
         }
 
-        if constexpr (StaticModel<Model>) {
-            return this->static_decompression<Model>(data, symb_list);
-        } if constexpr (AdaptativeModel<Model>) {
-            return this->adaptative_decompression<Model>(data, symb_list);
+        auto symbols = decompress_message.template operator()<PackedSymbolBuffer>();
+        if (not symbols.has_value()) {
+            return std::nullopt;
         }
 
-        static_assert(ProbabilityModel<Model>);
+        return PreprocessedPortugueseText(std::move(symbols).value());
     }
+
+    enum class ModelKind: uint8_t {
+        Static,
+        SemiStatic,
+        PPM,
+        HashedPPM,
+    };
+
+    enum class CoderKind: uint8_t {
+        Huffman,
+        Rans,
+    };
+
+    // Compressor picked at run time. Every valid config names one of the
+    // engines instantiated in compadre.cpp, and the engine streams start
+    // with it, so the decoder needs no flags.
+    struct EngineConfig {
+        ModelKind model = ModelKind::PPM;
+        uint8_t order = default_ppm_order;
+        CoderKind coder = CoderKind::Huffman;
+
+        static constexpr uint8_t default_ppm_order = 2;
+        static constexpr uint8_t max_ppm_order = 12;
+        static constexpr uint8_t max_semi_static_order = 1;
+        static constexpr std::size_t header_size = 3;
+
+        // The static model has no order, rANS is only behind the
+        // order-0 semi-static model and both PPMs need a prefix code.
+        [[nodiscard]]
+        auto is_valid() const -> bool;
+
+        void write_to(BitWriter& outbuff) const;
+        // Empty when the bytes name no engine.
+        static auto read_from(BitReader& inbuff) -> std::optional<EngineConfig>;
+    };
+
+    struct EngineOptions {
+        DictionaryMode dictionary_mode = DictionaryMode::None;
+        // Starting state of the (exact) PPM engines, of the same order.
+        const ModelSnapshot* snapshot = nullptr;
+    };
+
+    // Engine header followed by the stream of the engine's compressor.
+    auto compress_with_engine(const EngineConfig& config, const EngineOptions& options, PreprocessedPortugueseText& text) -> std::vector<u8>;
+    // Empty when the header names no engine, `snapshot` is of another
+    // order than the stream's PPM engine, or the stream starts from
+    // another snapshot (its id does not match).
+    auto decompress_with_engine(std::span<const u8> data, const ModelSnapshot* snapshot) -> std::optional<PreprocessedPortugueseText>;
+    // Snapshot of the PPM engine of `config`.
+    auto train_engine_snapshot(const EngineConfig& config, const EngineOptions& options, PreprocessedPortugueseText& text) -> std::vector<u8>;
+
+    // The engines are compiled once, in compadre.cpp.
+    extern template class Compressor<PreprocessedPortugueseText::StaticModel, Huffman>;
+    extern template class Compressor<SemiStatic<0>, Huffman>;
+    extern template class Compressor<SemiStatic<1>, Huffman>;
+    extern template class Compressor<SemiStatic<0>, Rans<>>;
+    extern template class Compressor<PPM<HuffmanSymbol, 0>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 1>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 2>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 3>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 4>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 5>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 6>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 7>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 8>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 9>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 10>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 11>, Huffman>;
+    extern template class Compressor<PPM<HuffmanSymbol, 12>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 0>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 1>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 2>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 3>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 4>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 5>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 6>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 7>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 8>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 9>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 10>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 11>, Huffman>;
+    extern template class Compressor<HashedPPM<HuffmanSymbol, 12>, Huffman>;
 }
 
 template <>
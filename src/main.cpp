@@ -6,6 +6,7 @@
 #include <fstream>
 #include <streambuf>
 #include <print>
+#include <charconv>
 
 auto collect_args(int argc, const char * argv[]) -> std::vector<std::string_view> { // NOLINT(modernize-avoid-c-arrays)
     auto args = std::vector<std::string_view>();
@@ -21,6 +22,13 @@ enum class UserOption: uint8_t {
     OutputFile,
     Compression,
     Decompression,
+    BuiltInDictionary,
+    StreamDictionary,
+    RansCoder,
+    Training,
+    Snapshot,
+    Model,
+    Order,
 };
 
 auto match_option(std::string_view user_input) -> std::optional<UserOption> {
@@ -32,6 +40,20 @@ auto match_option(std::string_view user_input) -> std::optional<UserOption> {
         return UserOption::Compression;
     } else if (user_input == "-d") {
         return UserOption::Decompression;
+    } else if (user_input == "-w") {
+        return UserOption::BuiltInDictionary;
+    } else if (user_input == "-W") {
+        return UserOption::StreamDictionary;
+    } else if (user_input == "-r") {
+        return UserOption::RansCoder;
+    } else if (user_input == "-t") {
+        return UserOption::Training;
+    } else if (user_input == "-s") {
+        return UserOption::Snapshot;
+    } else if (user_input == "-m") {
+        return UserOption::Model;
+    } else if (user_input == "-k") {
+        return UserOption::Order;
     }
 
     return std::nullopt;
@@ -43,7 +65,16 @@ void print_usage() {
                  "  -i <file-name>    Specify the input file\n"
                  "  -o <file-name>    Specify the output file\n"
                  "  -c                Enable file compression\n"
-                 "  -d                Enable file decompression");
+                 "  -d                Enable file decompression\n"
+                 "  -t                Write a PPM snapshot trained on the input file\n"
+                 "  -s <file-name>    Start the PPM model from a snapshot (also to decompress)\n"
+                 "  -m <model>        Model: static, semi-static, ppm (default) or hashed-ppm\n"
+                 "                    (PPM in a fixed 16 MiB table)\n"
+                 "  -k <order>        Context order: up to 1 (semi-static) or 12 (PPMs, default 2)\n"
+                 "  -w                Tokenize frequent words (built-in dictionary)\n"
+                 "  -W                Tokenize frequent words (dictionary stored in the file)\n"
+                 "  -r                Use the rANS coder (order-0 semi-static model)\n"
+                 "The decompression reads the model, order and coder from the file.");
 }
 
 void invalid_options_usage() {
@@ -57,10 +88,41 @@ struct UserInput {
     std::string output_filename = "out.comp";
     bool compression_mode;
     bool decompression_mode;
+    bool training_mode = false;
+    std::optional<std::string> snapshot_filename;
+    compadre::DictionaryMode dictionary_mode = compadre::DictionaryMode::None;
+    bool rans_coder = false;
+    std::optional<compadre::ModelKind> model;
+    std::optional<uint8_t> order;
 
     UserInput() = default;
 };
 
+auto match_model(std::string_view name) -> std::optional<compadre::ModelKind> {
+    if (name == "static") {
+        return compadre::ModelKind::Static;
+    } else if (name == "semi-static") {
+        return compadre::ModelKind::SemiStatic;
+    } else if (name == "ppm") {
+        return compadre::ModelKind::PPM;
+    } else if (name == "hashed-ppm") {
+        return compadre::ModelKind::HashedPPM;
+    }
+
+    return std::nullopt;
+}
+
+auto parse_order(std::string_view text) -> std::optional<uint8_t> {
+    unsigned order = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), order);
+    if (error != std::errc() || end != text.data() + text.size()
+            || order > compadre::EngineConfig::max_ppm_order) {
+        return std::nullopt;
+    }
+
+    return uint8_t(order);
+}
+
 // TODO: return struct with the options selected by the user
 auto treat_args(const std::vector<std::string_view>& args) -> UserInput {
     auto user_input = UserInput();
@@ -103,14 +165,69 @@ auto treat_args(const std::vector<std::string_view>& args) -> UserInput {
                         user_input.decompression_mode = true;
                     }
                     break;
+                case UserOption::BuiltInDictionary:
+                    {
+                        user_input.dictionary_mode = compadre::DictionaryMode::BuiltIn;
+                    }
+                    break;
+                case UserOption::StreamDictionary:
+                    {
+                        user_input.dictionary_mode = compadre::DictionaryMode::PerStream;
+                    }
+                    break;
+                case UserOption::RansCoder:
+                    {
+                        user_input.rans_coder = true;
+                    }
+                    break;
+                case UserOption::Training:
+                    {
+                        user_input.training_mode = true;
+                    }
+                    break;
+                case UserOption::Snapshot:
+                    {
+                        // Check if the next index is valid
+                        if (std::size_t(arg_index+1) < args.size()) {
+                            user_input.snapshot_filename = args.at(arg_index+1);
+                        } else {
+                            invalid_options_usage();
+                        }
+                    }
+                    break;
+                case UserOption::Model:
+                    {
+                        // Check if the next index is valid
+                        if (std::size_t(arg_index+1) < args.size()) {
+                            user_input.model = match_model(args.at(arg_index+1));
+                        }
+                        if (not user_input.model.has_value()) {
+                            std::println("Unknown model!");
+                            invalid_options_usage();
+                        }
+                    }
+                    break;
+                case UserOption::Order:
+                    {
+                        // Check if the next index is valid
+                        if (std::size_t(arg_index+1) < args.size()) {
+                            user_input.order = parse_order(args.at(arg_index+1));
+                        }
+                        if (not user_input.order.has_value()) {
+                            std::println("Invalid order!");
+                            invalid_options_usage();
+                        }
+                    }
+                    break;
                 default:
                     break;
             }
         }
     }
 
-    if (user_input.compression_mode == user_input.decompression_mode) {
-        std::println("Select one mode: compression (-c) or decompression (-d)!");
+    auto mode_count = int(user_input.compression_mode) + int(user_input.decompression_mode) + int(user_input.training_mode);
+    if (mode_count != 1) {
+        std::println("Select one mode: compression (-c), decompression (-d) or training (-t)!");
         invalid_options_usage();
     }
 
@@ -122,46 +239,122 @@ auto treat_args(const std::vector<std::string_view>& args) -> UserInput {
     return user_input;
 }
 
+// Engine of the compression and training modes. -r alone keeps
+// meaning the order-0 semi-static model with rANS.
+auto engine_config(const UserInput& user_input) -> compadre::EngineConfig {
+    auto config = compadre::EngineConfig();
+    config.model = user_input.model.value_or(
+            user_input.rans_coder ? compadre::ModelKind::SemiStatic : compadre::ModelKind::PPM);
+    config.coder = user_input.rans_coder ? compadre::CoderKind::Rans : compadre::CoderKind::Huffman;
+    auto is_ppm = config.model == compadre::ModelKind::PPM || config.model == compadre::ModelKind::HashedPPM;
+    config.order = user_input.order.value_or(is_ppm ? compadre::EngineConfig::default_ppm_order : 0);
+
+    if (not config.is_valid()) {
+        std::println("This model does not take this order or coder!");
+        invalid_options_usage();
+    }
+    if (user_input.training_mode && config.model != compadre::ModelKind::PPM) {
+        std::println("Only the PPM model is trained!");
+        invalid_options_usage();
+    }
+
+    return config;
+}
+
+auto read_text_file(const std::string& filename) -> std::string {
+    auto t = std::ifstream(filename);
+    return std::string(
+            std::istreambuf_iterator<char>(t),
+            std::istreambuf_iterator<char>()
+            );
+}
+
+void write_file(const std::string& filename, const std::vector<outbit::u8>& data) {
+    auto outbuff = outbit::BitBuffer();
+    outbuff.read_from_vector(data);
+    outbuff.write_as_file(filename);
+}
+
+// The snapshot must be of the order of `config`, when there is one.
+auto load_snapshot(const UserInput& user_input, const std::optional<compadre::EngineConfig>& config) -> std::optional<compadre::ModelSnapshot> {
+    if (not user_input.snapshot_filename.has_value()) {
+        return std::nullopt;
+    }
+
+    auto snapshot = compadre::ModelSnapshot::load_file(user_input.snapshot_filename.value());
+    if (not snapshot.has_value()) {
+        std::println("Cannot read the snapshot file!");
+        invalid_options_usage();
+    }
+    if (config.has_value() && config->model != compadre::ModelKind::PPM) {
+        std::println("Only the PPM model starts from a snapshot!");
+        invalid_options_usage();
+    }
+    if (config.has_value() && snapshot->order() != config->order) {
+        std::println("The snapshot is not of a PPM model of this order!");
+        invalid_options_usage();
+    }
+
+    return snapshot;
+}
+
+void train(const UserInput& user_input) {
+    auto config = engine_config(user_input);
+    auto snapshot = load_snapshot(user_input, config);
+    auto preproc = compadre::PreprocessedPortugueseText(read_text_file(user_input.input_filename.value()));
+
+    auto options = compadre::EngineOptions();
+    options.snapshot = snapshot.has_value() ? &snapshot.value() : nullptr;
+    // A per-stream dictionary cannot be part of a shared model.
+    if (user_input.dictionary_mode == compadre::DictionaryMode::BuiltIn) {
+        options.dictionary_mode = user_input.dictionary_mode;
+    }
+
+    write_file(user_input.output_filename, compadre::train_engine_snapshot(config, options, preproc));
+}
+
+void compress(const UserInput& user_input) {
+    auto config = engine_config(user_input);
+    auto snapshot = load_snapshot(user_input, config);
+    auto preproc = compadre::PreprocessedPortugueseText(read_text_file(user_input.input_filename.value()));
+
+    auto options = compadre::EngineOptions();
+    options.snapshot = snapshot.has_value() ? &snapshot.value() : nullptr;
+    options.dictionary_mode = user_input.dictionary_mode;
+    auto compressed_data = compadre::compress_with_engine(config, options, preproc);
+
+    write_file(user_input.output_filename, compressed_data);
+}
+
+void decompress(const UserInput& user_input) {
+    auto snapshot = load_snapshot(user_input, std::nullopt);
+
+    auto inbuff = outbit::BitBuffer();
+    inbuff.read_from_file(user_input.input_filename.value());
+    auto data = inbuff.buffer();
+
+    auto decompressed_text = compadre::decompress_with_engine(data, snapshot.has_value() ? &snapshot.value() : nullptr);
+    if (not decompressed_text.has_value()) {
+        std::println("Not a compadre file, or it starts from another snapshot!");
+        std::exit(1);
+    }
+
+    auto decompressed_chars = decompressed_text->as_string();
+    auto decompressed_data = std::vector<outbit::u8>(decompressed_chars.begin(), decompressed_chars.end());
+
+    write_file(user_input.output_filename, decompressed_data);
+}
+
 int main(int argc, const char * argv[]) {
     auto args = collect_args(argc, argv);
     auto user_input = treat_args(args);
 
-    using ProbabilityModel = compadre::PPM<compadre::HuffmanSymbol, 2>;
-    using CodingAlgorithm = compadre::Huffman;
-
-
-    if (user_input.compression_mode) {
-        auto t = std::ifstream(user_input.input_filename.value());
-        auto input_text = std::string(
-                std::istreambuf_iterator<char>(t),
-                std::istreambuf_iterator<char>()
-                );
-        auto preproc = compadre::PreprocessedPortugueseText(input_text);
-        auto compressor =
-            compadre::Compressor<ProbabilityModel, CodingAlgorithm>();
-        auto compressed_data = compressor.compress_preprocessed_portuguese_text(preproc);
-
-        // Write output
-        auto outbuff = outbit::BitBuffer();
-        outbuff.read_from_vector(compressed_data);
-        outbuff.write_as_file(user_input.output_filename);
-    } else if (user_input.decompression_mode) {
-        auto inbuff = outbit::BitBuffer();
-        inbuff.read_from_file(user_input.input_filename.value());
-        auto data = inbuff.buffer();
-
-        auto compressor =
-            compadre::Compressor<ProbabilityModel, CodingAlgorithm>();
-        auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(data);
-
-        auto decompressed_data = std::vector<outbit::u8>();
-        std::copy(decompressed_text.as_string().begin(),
-                decompressed_text.as_string().end(), std::back_inserter(decompressed_data));
-
-        // Write output
-        auto outbuff = outbit::BitBuffer();
-        outbuff.read_from_vector(decompressed_data);
-        outbuff.write_as_file(user_input.output_filename);
+    if (user_input.training_mode) {
+        train(user_input);
+    } else if (user_input.compression_mode) {
+        compress(user_input);
+    } else {
+        decompress(user_input);
     }
 
     return 0;
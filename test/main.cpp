@@ -3,6 +3,49 @@
 #include <string>
 #include <fstream>
 #include <ranges>
+#include <filesystem>
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation of the tests goes through here, so a test can
+// check that some code makes none.
+static std::size_t allocation_count = 0;
+
+void* operator new(std::size_t size) {
+    allocation_count++;
+    if (auto* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// Not inlined: GCC would see the free() of a new'd pointer.
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+// The pmr resources ask for aligned memory.
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocation_count++;
+    auto align = static_cast<std::size_t>(alignment);
+    auto rounded_size = (size + align - 1) / align * align;
+    if (auto* memory = std::aligned_alloc(align, rounded_size == 0 ? align : rounded_size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
 
 UTEST(preprocess, portuguese_text) {
     auto text = std::string("ÀÁÂÃÄÅ àáâãäå ÉÊËéêë ÍÎÏíîï ÓÔÕÖóôõö ÚÛÜúûü Çç 1234!@#$%^&*()-_=+[]{}|;:',.<>?/`~   ");
@@ -15,6 +58,39 @@ UTEST(preprocess, portuguese_text) {
     }
 }
 
+UTEST(PackedSymbolBuffer, pack_unpack) {
+    using namespace compadre;
+
+    auto symbol_ids = std::vector<u8>();
+    for (std::size_t i = 0; i < 1001; i++) {
+        symbol_ids.push_back(u8((i * 7 + i / 3) % PreprocessedPortugueseText::char_list.size()));
+    }
+
+    // Bulk packing and symbol by symbol packing give the same buffer.
+    auto packed = PackedSymbolBuffer::pack(symbol_ids);
+    auto pushed = PackedSymbolBuffer();
+    for (auto symb_id: symbol_ids) {
+        pushed.push_back(symb_id);
+    }
+
+    ASSERT_EQ(symbol_ids.size(), packed.size());
+    ASSERT_EQ(packed.byte_size(), (symbol_ids.size() * 5 + 7) / 8 + 1);
+    for (std::size_t i = 0; i < symbol_ids.size(); i++) {
+        ASSERT_EQ(symbol_ids[i], packed[i]);
+        ASSERT_EQ(symbol_ids[i], pushed[i]);
+    }
+
+    // Unaligned bulk unpack.
+    auto unpacked = std::vector<u8>(symbol_ids.size() - 3);
+    packed.unpack(3, unpacked);
+    for (std::size_t i = 0; i < unpacked.size(); i++) {
+        ASSERT_EQ(symbol_ids[i + 3], unpacked[i]);
+    }
+
+    auto text = std::string("ERA UMA VEZ");
+    ASSERT_EQ(text, compadre::PreprocessedPortugueseText::from_preprocessed(text).as_string());
+}
+
 // TODO: make this const
 static
 auto preproc_machado = compadre::PreprocessedPortugueseText(
@@ -43,10 +119,12 @@ UTEST(Shannon_Fano, preproc_little_roundtrip) {
     compressor = compadre::Compressor<compadre::PreprocessedPortugueseText::StaticModel, compadre::ShannonFano>();
     auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
 
-    ASSERT_EQ(preproc_machado.as_string().size(), decompressed_text.as_string().size());
+    auto expected = preproc_machado.as_string();
+    auto decompressed = decompressed_text.as_string();
+    ASSERT_EQ(expected.size(), decompressed.size());
 
-    for (std::size_t i = 0; i < preproc_machado.as_string().size(); i++) {
-        ASSERT_EQ(preproc_machado.as_string()[i], decompressed_text.as_string()[i]);
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i], decompressed[i]);
     }
 }
 
@@ -121,8 +199,36 @@ UTEST(SFTreeNode, inner_content_related_methods) {
     ASSERT_TRUE(typeid(symb) == typeid(compadre::SFSymbol));
 }
 
-// TODO: Add validation to the test
-/*
+UTEST(BitWriter, write_bits) {
+    auto writer = compadre::BitWriter();
+    writer.write_bits(0b101, 3);
+    writer.write_bits(0xFFFFFFFFFFFFFFFF, 64);
+    writer.write_bits(0b1, 1);
+    ASSERT_EQ(writer.bit_count(), std::size_t(68));
+
+    auto bytes = writer.finish();
+    ASSERT_EQ(bytes.size(), std::size_t(9));
+    ASSERT_EQ(bytes[0], compadre::u8(0xFD));
+    for (std::size_t i = 1; i < 8; i++) {
+        ASSERT_EQ(bytes[i], compadre::u8(0xFF));
+    }
+    ASSERT_EQ(bytes[8], compadre::u8(0x0F));
+}
+
+UTEST(BitReader, read_back) {
+    auto writer = compadre::BitWriter();
+    for (std::size_t length = 1; length <= 40; length++) {
+        writer.write_bits((uint64_t(1) << (length - 1)) | 1, length);
+    }
+    auto bytes = writer.finish();
+
+    auto reader = compadre::BitReader(bytes);
+    for (std::size_t length = 1; length <= 40; length++) {
+        ASSERT_EQ(reader.read_bits(length), (uint64_t(1) << (length - 1)) | 1);
+    }
+    ASSERT_EQ(reader.bit_position(), std::size_t(40 * 41 / 2));
+}
+
 UTEST(Huffman, generate_code_tree) {
     using namespace compadre;
     auto symb_list = typename SymbolListType<Huffman>::type();
@@ -139,9 +245,70 @@ UTEST(Huffman, generate_code_tree) {
     symb_list.push(D);
     symb_list.push(rho);
 
-    Huffman::generate_code_tree(symb_list);
+    auto tree = Huffman::generate_code_tree(symb_list);
+    ASSERT_EQ(tree.nodes_count(), std::size_t(9));
+    ASSERT_EQ(tree.root().get_content().value(), uint32_t(11));
+
+    auto code = tree.get_code_map();
+    // Bits in emission order: the root branch is bit 0.
+    auto expect_code = [&](HuffmanSymbol symb, uint32_t bits, uint8_t length) {
+        auto code_word = code.get(symb).value();
+        return code_word.bits == bits && code_word.length == length;
+    };
+
+    ASSERT_TRUE(expect_code(A, 0b1, 1));
+    ASSERT_TRUE(expect_code(B, 0b00, 2));
+    ASSERT_TRUE(expect_code(C, 0b0010, 4));
+    ASSERT_TRUE(expect_code(D, 0b1010, 4));
+    ASSERT_TRUE(expect_code(rho, 0b110, 3));
+    ASSERT_EQ(code[symbol_id('D')].bits, uint32_t(0b1010));
+
+    auto packed = tree.pack();
+    ASSERT_EQ(packed.nodes_count(), std::size_t(4));
+
+    auto bits = std::vector<Bit>{false, true, false, true, false, true, true};
+    auto next_bit = bits.begin();
+    auto read_bit = [&] { return *next_bit++; };
+    ASSERT_EQ(packed.decode(read_bit), symbol_id('D'));
+    ASSERT_EQ(packed.decode(read_bit), unknown_symbol_id);
+    ASSERT_TRUE(next_bit == bits.end());
+}
+
+UTEST(Huffman, limited_code_lengths) {
+    using namespace compadre;
+    auto weights = std::vector<uint64_t>{1, 1, 2, 4, 8, 16};
+    auto lengths = Huffman::limited_code_lengths(weights, 3);
+    auto expected = std::vector<uint8_t>{3, 3, 3, 3, 2, 2};
+    ASSERT_TRUE(lengths == expected);
+
+    // Unlimited, the static model needs 12 bits.
+    auto symb_list = typename SymbolListType<Huffman>::type();
+    for (char ch: PreprocessedPortugueseText::char_list) {
+        symb_list.push(HuffmanSymbol(ch, PreprocessedPortugueseText::StaticModel::occurencies_of(ch)));
+    }
+    auto code = Huffman::encode_symbol_list(symb_list);
+    ASSERT_EQ(code.max_length(), Huffman::max_code_length);
+}
+
+UTEST(Huffman, static_tables) {
+    using namespace compadre;
+    using Tables = StaticHuffmanTables<PreprocessedPortugueseText::StaticModel>;
+    static_assert(Tables::code.max_length() == Huffman::max_code_length);
+
+    // Same lengths the runtime construction finds.
+    auto symb_list = typename SymbolListType<Huffman>::type();
+    for (char ch: PreprocessedPortugueseText::char_list) {
+        symb_list.push(HuffmanSymbol(ch, PreprocessedPortugueseText::StaticModel::occurencies_of(ch)));
+    }
+    auto lengths = Huffman::encode_symbol_list(symb_list).code_lengths();
+    ASSERT_TRUE(lengths == Tables::lengths);
+
+    auto code = canonical_code<HuffmanSymbol>(lengths);
+    for (u8 symb_id = 0; symb_id < PreprocessedPortugueseText::char_list.size(); symb_id++) {
+        ASSERT_EQ(code[symb_id].bits, Tables::code[symb_id].bits);
+        ASSERT_EQ(code[symb_id].length, Tables::code[symb_id].length);
+    }
 }
-*/
 
 std::string read_file_as_string(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary); // Abre o arquivo em modo binário para preservar caracteres
@@ -153,6 +320,39 @@ std::string read_file_as_string(const std::string& filename) {
 }
 
 
+UTEST(MultiSymbolDecodeTable, decode) {
+    using namespace compadre;
+
+    // Codes 0, 10, 110 and 111 (first bit on the left).
+    auto lengths = CodeLengths{};
+    lengths[0] = 1;
+    lengths[1] = 2;
+    lengths[2] = 3;
+    lengths[3] = 3;
+    auto code = canonical_code<HuffmanSymbol>(lengths);
+    auto table = MultiSymbolDecodeTable(code);
+
+    auto message = std::vector<u8>{1, 0, 3, 2, 0, 0, 0, 3, 3, 3, 3, 1};
+    auto writer = BitWriter();
+    code.encode(message, writer);
+    auto bytes = writer.finish();
+
+    auto reader = BitReader(bytes);
+    auto decoded = std::vector<u8>();
+    auto lookups = std::vector<std::size_t>();
+    while (decoded.size() < message.size()) {
+        reader.refill();
+        auto symb_ids = std::array<u8, MultiSymbolDecodeTable::max_symbols>{};
+        auto count = table.decode(reader, symb_ids.data());
+        decoded.insert(decoded.end(), symb_ids.begin(), symb_ids.begin() + count);
+        lookups.push_back(count);
+    }
+
+    // 10 0 111 | 110 0 0 | 0 111 111 | 111 111 10
+    ASSERT_TRUE(decoded == message);
+    ASSERT_TRUE(lookups == std::vector<std::size_t>({3, 3, 3, 3}));
+}
+
 UTEST(Huffman, preproc_little_roundtrip) {
 
     auto compressor = compadre::Compressor<compadre::PreprocessedPortugueseText::StaticModel, compadre::Huffman>();
@@ -162,10 +362,12 @@ UTEST(Huffman, preproc_little_roundtrip) {
     compressor = compadre::Compressor<compadre::PreprocessedPortugueseText::StaticModel, compadre::Huffman>();
     auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
 
-    ASSERT_EQ(preproc_machado.as_string().size(), decompressed_text.as_string().size());
+    auto expected = preproc_machado.as_string();
+    auto decompressed = decompressed_text.as_string();
+    ASSERT_EQ(expected.size(), decompressed.size());
 
-    for (std::size_t i = 0; i < preproc_machado.as_string().size(); i++) {
-        ASSERT_EQ(preproc_machado.as_string()[i], decompressed_text.as_string()[i]);
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i], decompressed[i]);
     }
 }
 
@@ -182,11 +384,483 @@ UTEST(Huffman, preproc_roundtrip) {
     compressor = compadre::Compressor<compadre::PreprocessedPortugueseText::StaticModel, compadre::Huffman>();
     auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
 
-    ASSERT_EQ(preproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
+    auto expected = preproc_bras_cubas.as_string();
+    auto decompressed = decompressed_text.as_string();
+    ASSERT_EQ(expected.size(), decompressed.size());
+
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i], decompressed[i]);
+    }
+}
+
+UTEST(Huffman, interleaved_streams_roundtrip) {
+    using StaticCompressor = compadre::Compressor<compadre::PreprocessedPortugueseText::StaticModel, compadre::Huffman>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+    auto preproc_bras_cubas = compadre::PreprocessedPortugueseText(bras_cubas_string);
+
+    for (std::size_t stream_count: {1, 2, 3, 4, 7}) {
+        auto compressor = StaticCompressor();
+        compressor.set_interleaved_streams(stream_count);
+        auto compressed_data = compressor.compress_preprocessed_portuguese_text(preproc_bras_cubas);
+
+        compressor = StaticCompressor();
+        auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+        ASSERT_TRUE(preproc_bras_cubas.as_string() == decompressed_text.as_string());
+    }
+
+    // Substream headers (after the mode and the symbol count) that do
+    // not fit in the stream.
+    auto compressed_data = StaticCompressor().compress_preprocessed_portuguese_text(preproc_bras_cubas);
+    auto decodes = [](std::vector<uint8_t> data) {
+        return StaticCompressor().try_decompress_preprocessed_portuguese_text(data).has_value();
+    };
+    ASSERT_TRUE(decodes(compressed_data));
+    for (uint8_t stream_count: {0, 9, 255}) {
+        auto corrupt_data = compressed_data;
+        corrupt_data[5] = stream_count;
+        ASSERT_FALSE(decodes(corrupt_data));
+    }
+    for (std::size_t size_byte = 6; size_byte < 6 + 3 * sizeof(uint32_t); size_byte += sizeof(uint32_t)) {
+        auto corrupt_data = compressed_data;
+        corrupt_data[size_byte + 3] = 0x40;
+        ASSERT_FALSE(decodes(corrupt_data));
+    }
+    ASSERT_FALSE(decodes(std::vector<uint8_t>(compressed_data.begin(), compressed_data.begin() + 12)));
+}
+
+UTEST(SemiStatic, histogram_and_canonical_code) {
+    using namespace compadre;
+
+    auto symb_ids = std::vector<u8>{0, 1, 1, 2, 2, 2, 2, 3, 1, 0, 5};
+    auto histogram = SymbolHistogram();
+    histogram.add(symb_ids);
+    histogram.add(std::span(symb_ids).first(3));
+    auto counts = histogram.counts();
+    ASSERT_EQ(counts[0], 3u);
+    ASSERT_EQ(counts[1], 5u);
+    ASSERT_EQ(counts[2], 4u);
+    ASSERT_EQ(counts[3], 1u);
+    ASSERT_EQ(counts[4], 0u);
+    ASSERT_EQ(counts[5], 1u);
+
+    // Canonical code for lengths {2, 1, 3, 3}: 10, 0, 110, 111 (first
+    // bit on the left), stored in emission order.
+    auto lengths = CodeLengths{};
+    lengths[0] = 2;
+    lengths[1] = 1;
+    lengths[2] = 3;
+    lengths[3] = 3;
+    auto code = canonical_code<HuffmanSymbol>(lengths);
+    ASSERT_EQ(code[1].bits, 0b0u);
+    ASSERT_EQ(code[0].bits, 0b01u);
+    ASSERT_EQ(code[2].bits, 0b011u);
+    ASSERT_EQ(code[3].bits, 0b111u);
+    ASSERT_FALSE(code.has_code(4));
+
+    // Lengths survive the header.
+    auto header_ids = std::vector<u8>{0, 1, 2, 3, 4};
+    auto outbuff = BitWriter();
+    write_code_lengths(outbuff, lengths, header_ids);
+    auto bytes = outbuff.finish();
+    auto inbuff = BitReader(bytes);
+    ASSERT_TRUE(read_code_lengths(inbuff, header_ids) == lengths);
+
+    // Lengths that are no prefix code do not.
+    auto reads_back = [&](std::size_t bits_per_length, std::vector<uint64_t> header_lengths) {
+        auto header = BitWriter();
+        header.write(uint8_t(bits_per_length));
+        for (auto length: header_lengths) {
+            header.write_bits(length, bits_per_length);
+        }
+        auto header_bytes = header.finish();
+        auto header_buff = BitReader(header_bytes);
+        return read_code_lengths(header_buff, header_ids).has_value();
+    };
+    ASSERT_TRUE(reads_back(1, {0, 1, 0, 0, 0}));
+    ASSERT_TRUE(reads_back(7, {64, 1, 0, 0, 0}));
+    ASSERT_FALSE(reads_back(8, {0, 1, 0, 0, 0}));
+    ASSERT_FALSE(reads_back(7, {65, 1, 0, 0, 0}));
+    ASSERT_FALSE(reads_back(2, {1, 1, 2, 0, 0}));
+    ASSERT_FALSE(reads_back(3, {2, 2, 2, 2, 3}));
+}
+
+// Whether `text` comes back whole from a new compressor of the same type.
+template <typename CompressorType>
+bool compressor_roundtrip(const std::string& text, compadre::DictionaryMode dictionary_mode,
+        std::size_t interleaved_streams = CompressorType::default_interleaved_streams) {
+    auto preproc_text = compadre::PreprocessedPortugueseText(text);
+    auto compressor = CompressorType();
+    compressor.set_dictionary_mode(dictionary_mode);
+    compressor.set_interleaved_streams(interleaved_streams);
+    auto compressed_data = compressor.compress_preprocessed_portuguese_text(preproc_text);
+
+    compressor = CompressorType();
+    auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+    return preproc_text.as_string() == decompressed_text.as_string();
+}
+
+UTEST(SemiStatic, roundtrip) {
+    using namespace compadre;
+    using Order0 = Compressor<SemiStatic<0>, Huffman>;
+    using Order1 = Compressor<SemiStatic<1>, Huffman>;
+    // Codes longer than a decode table.
+    using Order1LongCodes = Compressor<SemiStatic<1>, ShannonFano>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    for (auto& text: {bras_cubas_string, std::string(), std::string("aaaa"), std::string("abc")}) {
+        for (auto dictionary_mode: {DictionaryMode::None, DictionaryMode::PerStream}) {
+            // A single stream follows the headers with no size of its own.
+            for (std::size_t streams: {std::size_t(1), Order0::default_interleaved_streams}) {
+                ASSERT_TRUE(compressor_roundtrip<Order0>(text, dictionary_mode, streams));
+                ASSERT_TRUE(compressor_roundtrip<Order1>(text, dictionary_mode, streams));
+            }
+        }
+    }
+
+    ASSERT_TRUE(compressor_roundtrip<Order1LongCodes>(bras_cubas_string, DictionaryMode::PerStream));
+
+    // Corrupt code lengths (past the mode and the symbol count) either
+    // decode to some text or are rejected.
+    auto first_chars = PreprocessedPortugueseText(bras_cubas_string.substr(0, 2000));
+    auto corrupt_headers = [&]<typename CompressorType>() {
+        auto compressed_data = CompressorType().compress_preprocessed_portuguese_text(first_chars);
+        for (std::size_t index = 5; index < std::min<std::size_t>(compressed_data.size(), 400); index++) {
+            for (uint8_t value: {uint8_t(0x00), uint8_t(0xFF), uint8_t(compressed_data[index] ^ 0x10)}) {
+                auto corrupt_data = compressed_data;
+                corrupt_data[index] = value;
+                CompressorType().try_decompress_preprocessed_portuguese_text(corrupt_data);
+            }
+        }
+        auto wide_lengths = compressed_data;
+        wide_lengths[5] = 0xFF;
+        return CompressorType().try_decompress_preprocessed_portuguese_text(wide_lengths).has_value();
+    };
+    ASSERT_FALSE(corrupt_headers.template operator()<Order0>());
+    ASSERT_FALSE(corrupt_headers.template operator()<Order1>());
+    ASSERT_FALSE(corrupt_headers.template operator()<Order1LongCodes>());
+}
+
+UTEST(PeriodicRebuild, roundtrip) {
+    using namespace compadre;
+    using RebuildCompressor = Compressor<PeriodicRebuild, Huffman>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    auto first_chapter = bras_cubas_string.substr(0, 5000);
+
+    for (auto& text: {bras_cubas_string, first_chapter, std::string(), std::string("abc")}) {
+        for (uint32_t period: {1u, 300u, PeriodicRebuild::default_period}) {
+            for (auto dictionary_mode: {DictionaryMode::None, DictionaryMode::PerStream}) {
+                if (period == 1 && text.size() > first_chapter.size()) {
+                    continue;
+                }
+
+                auto preproc_text = PreprocessedPortugueseText(text);
+                auto compressor = RebuildCompressor();
+                compressor.set_dictionary_mode(dictionary_mode);
+                compressor.set_rebuild_period(period);
+                auto compressed_data = compressor.compress_preprocessed_portuguese_text(preproc_text);
+
+                // The period comes from the header.
+                compressor = RebuildCompressor();
+                auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+                ASSERT_TRUE(preproc_text.as_string() == decompressed_text.as_string());
+            }
+        }
+    }
+}
+
+UTEST(Tunstall, encode_decode) {
+    using namespace compadre;
+
+    auto counts = SymbolCounts{};
+    counts[symbol_id('A')] = 6;
+    counts[symbol_id('B')] = 3;
+    counts[symbol_id(' ')] = 1;
+    auto coder = Tunstall(counts);
+    ASSERT_LE(coder.strings_count(), Tunstall::max_strings);
+    ASSERT_GT(coder.strings_count(), std::size_t(3));
+
+    auto symb_ids = std::vector<u8>();
+    for (char ch: std::string("AABA BAAAAB  AAABBBA")) {
+        symb_ids.push_back(symbol_id(ch));
+    }
+
+    // Every length of message, including strings cut by its end.
+    for (std::size_t size = 0; size <= symb_ids.size(); size++) {
+        auto outbuff = BitWriter();
+        coder.encode(std::span(symb_ids).first(size), outbuff);
+        auto bytes = outbuff.finish();
+        auto inbuff = BitReader(bytes);
+        auto decoded = coder.decode(inbuff, size);
+        ASSERT_TRUE(decoded.has_value());
+        ASSERT_TRUE(std::ranges::equal(*decoded, std::span(symb_ids).first(size)));
+    }
+
+    // A single symbol takes strings of the longest length.
+    auto single = SymbolCounts{};
+    single[symbol_id('A')] = 1;
+    auto single_coder = Tunstall(single);
+    ASSERT_EQ(single_coder.strings_count(), std::size_t(1));
+
+    // Indices past the dictionary are no stream of it.
+    auto past_end = std::vector<u8>{0xFF, 0xFF};
+    auto past_end_buff = BitReader(past_end);
+    ASSERT_FALSE(single_coder.decode(past_end_buff, 1).has_value());
+}
+
+UTEST(Tunstall, roundtrip) {
+    using namespace compadre;
+    using StaticTunstall = Compressor<PreprocessedPortugueseText::StaticModel, Tunstall>;
+    using SemiStaticTunstall = Compressor<SemiStatic<0>, Tunstall>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    for (auto& text: {bras_cubas_string, std::string(), std::string("aaaa"), std::string("abc")}) {
+        for (auto dictionary_mode: {DictionaryMode::None, DictionaryMode::PerStream}) {
+            ASSERT_TRUE(compressor_roundtrip<StaticTunstall>(text, dictionary_mode));
+            ASSERT_TRUE(compressor_roundtrip<SemiStaticTunstall>(text, dictionary_mode));
+        }
+    }
+
+    // An index stands for strings of several symbols: below the 5 bits
+    // a symbol takes packed.
+    auto preproc_text = PreprocessedPortugueseText(bras_cubas_string);
+    auto packed_size = preproc_text.size() * 5 / 8;
+    ASSERT_LT(StaticTunstall().compress_preprocessed_portuguese_text(preproc_text).size(), packed_size);
+    ASSERT_LT(SemiStaticTunstall().compress_preprocessed_portuguese_text(preproc_text).size(), packed_size);
+}
+
+UTEST(Rans, quantized_counts) {
+    using namespace compadre;
+
+    auto counts = SymbolCounts{};
+    counts[symbol_id('A')] = 1000000;
+    counts[symbol_id('B')] = 1;
+    counts[symbol_id('C')] = 3;
+    auto quantized = quantized_counts(counts, 12);
+    ASSERT_EQ(std::accumulate(quantized.begin(), quantized.end(), uint32_t(0)), uint32_t(1) << 12);
+    ASSERT_EQ(quantized[symbol_id('B')], uint32_t(1));
+    ASSERT_EQ(quantized[symbol_id('C')], uint32_t(1));
+    ASSERT_EQ(quantized[symbol_id('D')], uint32_t(0));
+
+    ASSERT_TRUE(quantized_counts(SymbolCounts{}, 12) == SymbolCounts{});
+}
+
+UTEST(Rans, roundtrip) {
+    using namespace compadre;
+    using StaticRans = Compressor<PreprocessedPortugueseText::StaticModel, Rans<>>;
+    using SemiStaticRans2 = Compressor<SemiStatic<0>, Rans<2>>;
+    using SemiStaticRans8 = Compressor<SemiStatic<0>, Rans<8>>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    for (auto& text: {bras_cubas_string, std::string(), std::string("aaaa"), std::string("abc")}) {
+        for (auto dictionary_mode: {DictionaryMode::None, DictionaryMode::PerStream}) {
+            ASSERT_TRUE(compressor_roundtrip<StaticRans>(text, dictionary_mode));
+            ASSERT_TRUE(compressor_roundtrip<SemiStaticRans2>(text, dictionary_mode));
+            ASSERT_TRUE(compressor_roundtrip<SemiStaticRans8>(text, dictionary_mode));
+        }
+    }
+
+    // Fractional bits per symbol: smaller than the Huffman code of the
+    // same counts, whatever the number of lanes.
+    auto preproc_text = PreprocessedPortugueseText(bras_cubas_string);
+    auto static_huffman_size = Compressor<PreprocessedPortugueseText::StaticModel, Huffman>()
+        .compress_preprocessed_portuguese_text(preproc_text).size();
+    auto semi_static_huffman_size = Compressor<SemiStatic<0>, Huffman>()
+        .compress_preprocessed_portuguese_text(preproc_text).size();
+    ASSERT_LT(StaticRans().compress_preprocessed_portuguese_text(preproc_text).size(), static_huffman_size);
+    ASSERT_LT(SemiStaticRans2().compress_preprocessed_portuguese_text(preproc_text).size(), semi_static_huffman_size);
+    ASSERT_LT(SemiStaticRans8().compress_preprocessed_portuguese_text(preproc_text).size(), semi_static_huffman_size);
+}
+
+UTEST(CumulativeCounts, queries) {
+    using namespace compadre;
+
+    auto counts = std::vector<uint32_t>{0, 3, 1, 7, 2, 5, 1};
+    auto tree = CumulativeCounts();
+    for (auto count: counts) {
+        tree.push(count);
+    }
+    tree.add(2, 4);
+    counts[2] += 4;
+
+    auto check = [&]() {
+        uint32_t low = 0;
+        for (std::size_t position = 0; position < counts.size(); position++) {
+            if (tree.cumulative(position) != low || tree.count(position) != counts[position]) {
+                return false;
+            }
+            for (auto target = low; target < low + counts[position]; target++) {
+                if (tree.find(target) != position) {
+                    return false;
+                }
+            }
+            low += counts[position];
+        }
+        return tree.total() == low;
+    };
+    ASSERT_TRUE(check());
+
+    tree.halve();
+    for (auto& count: counts) {
+        count = (count + 1) / 2;
+    }
+    ASSERT_TRUE(check());
+}
+
+UTEST(PPM_Context, cumulative_ranges) {
+    using namespace compadre;
+    using HuffmanContext = Context<HuffmanSymbol, 2>;
+
+    auto ctx = HuffmanContext();
+    for (char ch: std::string("ABACABAD")) {
+        auto symb = HuffmanSymbol(ch);
+        ctx.add_symbol_occurency_and_inc_rho(symb);
+    }
+
+    // rho, A, B, C, D with 4, 4, 2, 1, 1.
+    ASSERT_EQ(ctx.total_count(), uint32_t(12));
+    ASSERT_TRUE(ctx.cumulative_range(HuffmanSymbol()) == std::make_pair(uint32_t(0), uint32_t(4)));
+    ASSERT_TRUE(ctx.cumulative_range(HuffmanSymbol('B')) == std::make_pair(uint32_t(8), uint32_t(10)));
+    ASSERT_EQ(ctx.symbol_at(11).inner().value(), 'D');
+    ASSERT_EQ(ctx.symbols().at(ctx.position_of(HuffmanSymbol('A')).value()).attribute().value(), uint32_t(4));
+
+    // Counts stay bounded.
+    auto symb = HuffmanSymbol('A');
+    for (uint32_t i = 0; i < HuffmanContext::max_total; i++) {
+        ctx.add_symbol_occurency(symb);
+    }
+    ASSERT_LE(ctx.total_count(), HuffmanContext::max_total);
+    ASSERT_EQ(ctx.cumulative_range(HuffmanSymbol('D')).second, ctx.total_count());
+}
+
+UTEST(PPM_Context, encoding_steps) {
+    using namespace compadre;
+
+    auto symb_list = SymbolList<HuffmanSymbol>();
+    for (char ch: std::string(" AB")) {
+        symb_list.push(HuffmanSymbol(ch, 1));
+    }
+    auto model = PPM<HuffmanSymbol, 1>(symb_list);
+
+    // (symbol, its count, distribution size) of every step.
+    auto steps = std::vector<std::tuple<char, uint32_t, std::size_t>>();
+    auto encode = [&](char ch) {
+        steps.clear();
+        auto symb = HuffmanSymbol(ch);
+        model.occurencies_of(symb, [&](const HuffmanSymbol& symb_to_code, SymbolList<HuffmanSymbol>& distribution) {
+            auto symb_char = symb_to_code.is_unknown() ? '?' : symb_to_code.inner().value();
+            steps.emplace_back(symb_char, symb_to_code.attribute().value(), distribution.size());
+        });
+    };
+
+    // No context yet: equiprobable list.
+    encode('A');
+    ASSERT_TRUE(steps == (std::vector<std::tuple<char, uint32_t, std::size_t>>{{'A', 1, 3}}));
+
+    // Order 0 has rho and A, with the counts before this symbol.
+    encode('A');
+    ASSERT_TRUE(steps == (std::vector<std::tuple<char, uint32_t, std::size_t>>{{'A', 1, 2}}));
+
+    // Escapes from the context "A" and from order 0, then the two
+    // symbols never seen.
+    encode('B');
+    ASSERT_TRUE(steps == (std::vector<std::tuple<char, uint32_t, std::size_t>>{{'?', 1, 2}, {'?', 1, 2}, {'B', 1, 2}}));
+}
 
-    for (std::size_t i = 0; i < preproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(preproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+UTEST(PPM_Context, coding_symbols) {
+    using namespace compadre;
+    using HuffmanContext = Context<HuffmanSymbol, 2>;
+
+    auto ctx = HuffmanContext();
+    auto symb = HuffmanSymbol('A');
+    auto counts_of = [](SymbolList<HuffmanSymbol>& list) {
+        auto counts = std::vector<uint32_t>();
+        for (auto& list_symb: list) {
+            counts.push_back(list_symb.attribute().value());
+        }
+        return counts;
+    };
+
+    // Up to a refresh past the first 100 symbols.
+    for (int i = 0; i < 100; i++) {
+        ctx.add_symbol_occurency_and_inc_rho(symb);
+    }
+    for (auto version = ctx.version(); ctx.version() == version;) {
+        ctx.add_symbol_occurency_and_inc_rho(symb);
+    }
+    auto version = ctx.version();
+    auto coded_counts = counts_of(ctx.coding_symbols());
+    auto coded_total = std::accumulate(coded_counts.begin(), coded_counts.end(), uint32_t(0));
+
+    // The coding counts stay put until the total grows by 1/8.
+    uint32_t adds = 0;
+    while (ctx.version() == version) {
+        ASSERT_TRUE(counts_of(ctx.coding_symbols()) == coded_counts);
+        ctx.add_symbol_occurency_and_inc_rho(symb);
+        adds++;
     }
+    ASSERT_EQ(adds, coded_total / HuffmanContext::refresh_divisor);
+    ASSERT_TRUE(counts_of(ctx.coding_symbols()) == counts_of(ctx.symbols()));
+
+    // A new symbol refreshes them at once.
+    auto new_symb = HuffmanSymbol('B');
+    ctx.add_symbol_occurency_and_inc_rho(new_symb);
+    ASSERT_EQ(ctx.version(), version + 2);
+    ASSERT_EQ(ctx.coding_symbols().size(), ctx.symbols().size());
+}
+
+UTEST(BinaryArithmeticCoder, encode_decode) {
+    using namespace compadre;
+
+    // Skewed and even probabilities, including the extremes.
+    auto bits = std::vector<bool>();
+    auto probabilities = std::vector<uint32_t>();
+    for (uint32_t i = 0; i < 5000; i++) {
+        bits.push_back(i % 7 == 0 || i % 13 == 5);
+        probabilities.push_back(std::array<uint32_t, 5>{1, 600, 2048, 3500, 4095}[i % 5]);
+    }
+
+    auto outbuff = BitWriter();
+    auto encoder = BinaryArithmeticCoder::Encoder(outbuff);
+    for (std::size_t i = 0; i < bits.size(); i++) {
+        encoder.encode(bits[i], probabilities[i]);
+    }
+    encoder.finish();
+    auto bytes = outbuff.finish();
+
+    auto inbuff = BitReader(bytes);
+    auto decoder = BinaryArithmeticCoder::Decoder(inbuff);
+    for (std::size_t i = 0; i < bits.size(); i++) {
+        ASSERT_EQ(decoder.decode(probabilities[i]), bits[i]);
+    }
+}
+
+UTEST(BinaryContext, roundtrip) {
+    using namespace compadre;
+    using Order2 = Compressor<BinaryContext<2>, BinaryArithmeticCoder>;
+    using Order0 = Compressor<BinaryContext<0>, BinaryArithmeticCoder>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    for (auto& text: {bras_cubas_string, std::string(), std::string("aaaa"), std::string("abc")}) {
+        for (auto dictionary_mode: {DictionaryMode::None, DictionaryMode::PerStream}) {
+            ASSERT_TRUE(compressor_roundtrip<Order2>(text, dictionary_mode));
+        }
+    }
+    ASSERT_TRUE(compressor_roundtrip<Order0>(bras_cubas_string, DictionaryMode::None));
+
+    // A corrupt payload (past the mode and the symbol count) decodes to
+    // some text of the right length.
+    auto first_chars = PreprocessedPortugueseText(bras_cubas_string.substr(0, 2000));
+    auto corrupt_data = Order2().compress_preprocessed_portuguese_text(first_chars);
+    for (std::size_t index = 5; index < corrupt_data.size(); index++) {
+        corrupt_data[index] = u8((index * 2654435761u) >> 13);
+    }
+    ASSERT_EQ(Order2().decompress_preprocessed_portuguese_text(corrupt_data).size(), first_chars.size());
+
+    // The previous symbols sharpen the bit probabilities.
+    auto preproc_text = PreprocessedPortugueseText(bras_cubas_string);
+    ASSERT_LT(Order2().compress_preprocessed_portuguese_text(preproc_text).size(),
+            Order0().compress_preprocessed_portuguese_text(preproc_text).size());
 }
 
 UTEST(PPM_Huffman, preproc_little_roundtrip_test) {
@@ -200,10 +874,12 @@ UTEST(PPM_Huffman, preproc_little_roundtrip_test) {
     compressor = Compressor< PPM<HuffmanSymbol, 0> , Huffman>();
     auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
 
-    ASSERT_EQ(preproc_test.as_string().size(), decompressed_text.as_string().size());
+    auto expected = preproc_test.as_string();
+    auto decompressed = decompressed_text.as_string();
+    ASSERT_EQ(expected.size(), decompressed.size());
 
-    for (std::size_t i = 0; i < preproc_test.as_string().size(); i++) {
-        ASSERT_EQ(preproc_test.as_string()[i], decompressed_text.as_string()[i]);
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i], decompressed[i]);
     }
 }
 
@@ -218,10 +894,12 @@ UTEST(PPM_Huffman, preproc_little_roundtrip) {
     compressor = Compressor< PPM<HuffmanSymbol, 10> , Huffman>();
     auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
 
-    ASSERT_EQ(preproc_machado.as_string().size(), decompressed_text.as_string().size());
+    auto expected = preproc_machado.as_string();
+    auto decompressed = decompressed_text.as_string();
+    ASSERT_EQ(expected.size(), decompressed.size());
 
-    for (std::size_t i = 0; i < preproc_machado.as_string().size(); i++) {
-        ASSERT_EQ(preproc_machado.as_string()[i], decompressed_text.as_string()[i]);
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i], decompressed[i]);
     }
 }
 
@@ -238,13 +916,315 @@ UTEST(PPM_Huffman, preproc_roundtrip) {
     compressor = Compressor< PPM<HuffmanSymbol, 2> , Huffman>();
     auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
+    auto expected = precproc_bras_cubas.as_string();
+    auto decompressed = decompressed_text.as_string();
+    ASSERT_EQ(expected.size(), decompressed.size());
 
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i], decompressed[i]);
     }
 }
 
+UTEST(PPM_Huffman, snapshot) {
+    using namespace compadre;
+    using PPMCompressor = Compressor<PPM<HuffmanSymbol, 2>, Huffman>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    auto reference = PreprocessedPortugueseText(bras_cubas_string.substr(0, 20000));
+    auto message = PreprocessedPortugueseText(bras_cubas_string.substr(20000, 2000));
+
+    for (auto dictionary_mode: {DictionaryMode::None, DictionaryMode::BuiltIn}) {
+        auto compressor = PPMCompressor();
+        compressor.set_dictionary_mode(dictionary_mode);
+        auto snapshot = ModelSnapshot(compressor.train_snapshot(reference));
+        auto plain_size = compressor.compress_preprocessed_portuguese_text(message).size();
+
+        compressor.set_snapshot(&snapshot);
+        auto compressed_data = compressor.compress_preprocessed_portuguese_text(message);
+        ASSERT_LT(compressed_data.size(), plain_size);
+
+        auto decompressor = PPMCompressor();
+        decompressor.set_snapshot(&snapshot);
+        auto decompressed_text = decompressor.decompress_preprocessed_portuguese_text(compressed_data);
+        ASSERT_EQ(message.as_string(), decompressed_text.as_string());
+    }
+
+    // The same snapshot, read from a file.
+    auto compressor = PPMCompressor();
+    auto snapshot_bytes = compressor.train_snapshot(reference);
+    auto path = (std::filesystem::temp_directory_path() / "compadre_snapshot_test.ppms").string();
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(snapshot_bytes.data()), std::streamsize(snapshot_bytes.size()));
+
+    auto loaded = ModelSnapshot::load_file(path);
+    ASSERT_TRUE(loaded.has_value());
+    ASSERT_EQ(loaded->id(), ModelSnapshot(snapshot_bytes).id());
+    compressor.set_snapshot(&loaded.value());
+    auto compressed_data = compressor.compress_preprocessed_portuguese_text(message);
+    auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+    ASSERT_EQ(message.as_string(), decompressed_text.as_string());
+    std::filesystem::remove(path);
+
+    ASSERT_FALSE(ModelSnapshot::load_file(path).has_value());
+}
+
+UTEST(PPM_Huffman, snapshot_errors) {
+    using namespace compadre;
+    using PPMCompressor = Compressor<PPM<HuffmanSymbol, 2>, Huffman>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    auto reference = PreprocessedPortugueseText(bras_cubas_string.substr(0, 20000));
+    auto message = PreprocessedPortugueseText(bras_cubas_string.substr(20000, 2000));
+    auto compressor = PPMCompressor();
+    auto snapshot = ModelSnapshot(compressor.train_snapshot(reference));
+    auto other_snapshot = ModelSnapshot(compressor.train_snapshot(message));
+    compressor.set_snapshot(&snapshot);
+    auto compressed_data = compressor.compress_preprocessed_portuguese_text(message);
+
+    // The stream needs its own snapshot.
+    auto decompressor = PPMCompressor();
+    ASSERT_FALSE(decompressor.try_decompress_preprocessed_portuguese_text(compressed_data).has_value());
+    decompressor.set_snapshot(&other_snapshot);
+    ASSERT_FALSE(decompressor.try_decompress_preprocessed_portuguese_text(compressed_data).has_value());
+    decompressor.set_snapshot(&snapshot);
+    auto decompressed_text = decompressor.try_decompress_preprocessed_portuguese_text(compressed_data);
+    ASSERT_TRUE(decompressed_text.has_value());
+    ASSERT_EQ(message.as_string(), decompressed_text->as_string());
+
+    // A stream without one decodes whatever snapshot is set.
+    compressor.set_snapshot(nullptr);
+    compressed_data = compressor.compress_preprocessed_portuguese_text(message);
+    decompressed_text = decompressor.try_decompress_preprocessed_portuguese_text(compressed_data);
+    ASSERT_TRUE(decompressed_text.has_value());
+    ASSERT_EQ(message.as_string(), decompressed_text->as_string());
+
+    // Bytes that are not a whole snapshot of the model do not load.
+    auto symb_list = SymbolList<HuffmanSymbol>();
+    for (auto ch: PreprocessedPortugueseText::char_list) {
+        symb_list.push(HuffmanSymbol(ch));
+    }
+    auto loads = [&](std::vector<u8> bytes) {
+        return PPM<HuffmanSymbol, 2>::from_snapshot(symb_list, ModelSnapshot(std::move(bytes))).has_value();
+    };
+    auto bytes = std::vector<u8>(snapshot.bytes().begin(), snapshot.bytes().end());
+    ASSERT_TRUE(loads(bytes));
+    using OtherOrder = PPM<HuffmanSymbol, 3>;
+    ASSERT_FALSE(OtherOrder::from_snapshot(symb_list, snapshot).has_value());
+    for (std::size_t size: {std::size_t(0), std::size_t(3), std::size_t(5), bytes.size() / 2, bytes.size() - 1}) {
+        ASSERT_FALSE(loads(std::vector<u8>(bytes.begin(), bytes.begin() + std::ptrdiff_t(size))));
+    }
+    auto longer = bytes;
+    longer.push_back(0);
+    ASSERT_FALSE(loads(longer));
+    auto other_magic = bytes;
+    other_magic[0] ^= 1;
+    ASSERT_FALSE(loads(other_magic));
+    // Context count of order 0 (after the two symbol lists).
+    auto many_contexts = bytes;
+    auto symbol_lists_size = 2 + bytes[5] + bytes[6 + bytes[5]];
+    many_contexts[5 + symbol_lists_size + 3] = 0xFF;
+    ASSERT_FALSE(loads(many_contexts));
+}
+
+UTEST(PPM_Huffman, steady_state_allocations) {
+    using namespace compadre;
+    using PPMCompressor = Compressor<PPM<HuffmanSymbol, 2>, Huffman>;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+
+    // The messages repeat a passage the snapshot has not seen. Its first
+    // copy is the warm-up, where the model grows; the copies after it
+    // only meet contexts and symbols already there, so coding them may
+    // not touch the heap at all.
+    auto compressor = PPMCompressor();
+    auto reference = PreprocessedPortugueseText(bras_cubas_string.substr(0, 20000));
+    auto snapshot = ModelSnapshot(compressor.train_snapshot(reference));
+    compressor.set_snapshot(&snapshot);
+    auto passage = bras_cubas_string.substr(100000, 4000);
+
+    auto allocations_of = [&](std::size_t copies) {
+        auto text = std::string();
+        for (std::size_t copy = 0; copy < copies; copy++) {
+            text += passage;
+        }
+        auto message = PreprocessedPortugueseText(text);
+        auto before = allocation_count;
+        auto compressed_data = compressor.compress_preprocessed_portuguese_text(message);
+        auto compression = allocation_count - before;
+
+        before = allocation_count;
+        auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+        auto decompression = allocation_count - before;
+
+        return std::tuple(compression, decompression, message.as_string() == decompressed_text.as_string());
+    };
+
+    auto [short_compression, short_decompression, short_roundtrip] = allocations_of(2);
+    auto [long_compression, long_decompression, long_roundtrip] = allocations_of(6);
+    ASSERT_TRUE(short_roundtrip);
+    ASSERT_TRUE(long_roundtrip);
+    ASSERT_EQ(short_compression, long_compression);
+    ASSERT_EQ(short_decompression, long_decompression);
+}
+
+UTEST(HashedPPM, roundtrip) {
+    using namespace compadre;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+    auto message = PreprocessedPortugueseText(bras_cubas_string.substr(0, 100000));
+
+    auto exact_size = Compressor<PPM<HuffmanSymbol, 3>, Huffman>().compress_preprocessed_portuguese_text(message).size();
+
+    // With room for every context it codes as the exact model does, but
+    // for the symbols the full slots drop.
+    auto compressor = Compressor<HashedPPM<HuffmanSymbol, 3>, Huffman>();
+    auto compressed_data = compressor.compress_preprocessed_portuguese_text(message);
+    ASSERT_LT(double(compressed_data.size()), double(exact_size) * 1.02);
+    auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+    ASSERT_EQ(message.as_string(), decompressed_text.as_string());
+
+    // Far more order-8 contexts than the 16384 slots of 1 MiB: contexts
+    // take each other's slots, the same way in both directions.
+    auto small_compressor = Compressor<HashedPPM<HuffmanSymbol, 8, 1>, Huffman>();
+    compressed_data = small_compressor.compress_preprocessed_portuguese_text(message);
+    decompressed_text = small_compressor.decompress_preprocessed_portuguese_text(compressed_data);
+    ASSERT_EQ(message.as_string(), decompressed_text.as_string());
+
+    // Corrupt payloads (past the mode, the snapshot id and the symbol
+    // count) decode to some text or, when an escape leaves no symbol
+    // to code, are rejected.
+    using Order2 = Compressor<HashedPPM<HuffmanSymbol, 2>, Huffman>;
+    auto first_chars = PreprocessedPortugueseText(bras_cubas_string.substr(0, 3000));
+    compressed_data = Order2().compress_preprocessed_portuguese_text(first_chars);
+    std::size_t rejected = 0;
+    for (std::size_t seed = 0; seed < 40; seed++) {
+        auto corrupt_data = compressed_data;
+        for (std::size_t index = 9; index < corrupt_data.size(); index++) {
+            corrupt_data[index] = u8(((index + 3) * 2654435761u + seed * 40503) >> 13);
+        }
+        if (not Order2().try_decompress_preprocessed_portuguese_text(corrupt_data).has_value()) {
+            rejected++;
+        }
+    }
+    ASSERT_GT(rejected, std::size_t(0));
+}
+
+UTEST(WordDictionary, tokenize_roundtrip) {
+    using namespace compadre;
+
+    auto dictionary = WordDictionary::portuguese();
+    auto text = preproc_machado.as_string();
+    auto tokenized = dictionary.tokenize(text);
+
+    ASSERT_LT(tokenized.size(), text.size());
+    ASSERT_TRUE(WordDictionary::is_token(dictionary.tokenize("DE").front()));
+    ASSERT_EQ(dictionary.tokenize("A DE"), std::string("A ") + WordDictionary::token_of(0));
+    ASSERT_EQ(text, dictionary.detokenize(tokenized));
+
+    auto stream_dictionary = WordDictionary::from_text(text);
+    ASSERT_TRUE(stream_dictionary.size() <= WordDictionary::max_words);
+    ASSERT_EQ(text, stream_dictionary.detokenize(stream_dictionary.tokenize(text)));
+}
+
+UTEST(WordDictionary, compressor_roundtrip) {
+    using namespace compadre;
+
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+    auto precproc_bras_cubas = PreprocessedPortugueseText(bras_cubas_string);
+
+    for (auto mode: {DictionaryMode::BuiltIn, DictionaryMode::PerStream}) {
+        auto compressor = Compressor<PreprocessedPortugueseText::StaticModel, Huffman>();
+        compressor.set_dictionary_mode(mode);
+        auto compressed_data = compressor.compress_preprocessed_portuguese_text(precproc_bras_cubas);
+
+        compressor = Compressor<PreprocessedPortugueseText::StaticModel, Huffman>();
+        auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+
+        ASSERT_EQ(precproc_bras_cubas.as_string(), decompressed_text.as_string());
+    }
+
+    // A mode byte that names no mode.
+    auto compressor = Compressor<PreprocessedPortugueseText::StaticModel, Huffman>();
+    auto compressed_data = compressor.compress_preprocessed_portuguese_text(precproc_bras_cubas);
+    compressed_data[0] = uint8_t(DictionaryMode::PerStream) + 1;
+    ASSERT_FALSE(compressor.try_decompress_preprocessed_portuguese_text(compressed_data).has_value());
+
+    // Per-stream words (count, then length and chars of each) that the
+    // tokens cannot stand for.
+    compressor.set_dictionary_mode(DictionaryMode::PerStream);
+    compressed_data = compressor.compress_preprocessed_portuguese_text(precproc_bras_cubas);
+    auto too_many_words = compressed_data;
+    too_many_words[1] = uint8_t(WordDictionary::max_words + 1);
+    ASSERT_FALSE(compressor.try_decompress_preprocessed_portuguese_text(too_many_words).has_value());
+    for (uint8_t ch: {uint8_t('a'), uint8_t('.'), uint8_t(WordDictionary::first_token)}) {
+        auto other_char = compressed_data;
+        other_char[3] = ch;
+        ASSERT_FALSE(compressor.try_decompress_preprocessed_portuguese_text(other_char).has_value());
+    }
+
+    for (auto mode: {DictionaryMode::BuiltIn, DictionaryMode::PerStream}) {
+        auto compressor = Compressor< PPM<HuffmanSymbol, 2> , Huffman>();
+        compressor.set_dictionary_mode(mode);
+        auto compressed_data = compressor.compress_preprocessed_portuguese_text(preproc_machado);
+
+        compressor = Compressor< PPM<HuffmanSymbol, 2> , Huffman>();
+        auto decompressed_text = compressor.decompress_preprocessed_portuguese_text(compressed_data);
+
+        ASSERT_EQ(preproc_machado.as_string(), decompressed_text.as_string());
+    }
+}
+
+UTEST(Engine, roundtrip) {
+    using namespace compadre;
+    auto bras_cubas_string = read_file_as_string("MemoriasPostumas.txt");
+    auto message = PreprocessedPortugueseText(bras_cubas_string.substr(0, 3000));
+
+    auto configs = std::vector<EngineConfig>{
+        {ModelKind::Static, 0, CoderKind::Huffman},
+        {ModelKind::SemiStatic, 0, CoderKind::Huffman},
+        {ModelKind::SemiStatic, 1, CoderKind::Huffman},
+        {ModelKind::SemiStatic, 0, CoderKind::Rans},
+        {ModelKind::PPM, 0, CoderKind::Huffman},
+        {ModelKind::PPM, 5, CoderKind::Huffman},
+        {ModelKind::PPM, EngineConfig::max_ppm_order, CoderKind::Huffman},
+        {ModelKind::HashedPPM, 6, CoderKind::Huffman},
+    };
+    for (auto& config: configs) {
+        ASSERT_TRUE(config.is_valid());
+        auto compressed_data = compress_with_engine(config, EngineOptions(), message);
+        ASSERT_EQ(compressed_data[0], u8(config.model));
+        ASSERT_EQ(compressed_data[1], config.order);
+
+        // The decoder takes the engine from the header alone.
+        auto decompressed_text = decompress_with_engine(compressed_data, nullptr);
+        ASSERT_TRUE(decompressed_text.has_value());
+        ASSERT_EQ(message.as_string(), decompressed_text->as_string());
+    }
+
+    ASSERT_FALSE((EngineConfig{ModelKind::SemiStatic, 2, CoderKind::Huffman}.is_valid()));
+    ASSERT_FALSE((EngineConfig{ModelKind::PPM, 2, CoderKind::Rans}.is_valid()));
+    ASSERT_FALSE((EngineConfig{ModelKind::PPM, EngineConfig::max_ppm_order + 1, CoderKind::Huffman}.is_valid()));
+    ASSERT_FALSE(decompress_with_engine(std::vector<u8>{u8(ModelKind::PPM), 13, 0, 0}, nullptr).has_value());
+
+    // A snapshot only decodes the streams of its own order.
+    auto config = EngineConfig{ModelKind::PPM, 3, CoderKind::Huffman};
+    auto reference = PreprocessedPortugueseText(bras_cubas_string.substr(3000, 20000));
+    auto snapshot = ModelSnapshot(train_engine_snapshot(config, EngineOptions(), reference));
+    ASSERT_EQ(snapshot.order(), std::optional<std::size_t>(3));
+
+    auto options = EngineOptions();
+    options.snapshot = &snapshot;
+    auto compressed_data = compress_with_engine(config, options, message);
+    auto decompressed_text = decompress_with_engine(compressed_data, &snapshot);
+    ASSERT_TRUE(decompressed_text.has_value());
+    ASSERT_EQ(message.as_string(), decompressed_text->as_string());
+
+    auto other_order = compress_with_engine(EngineConfig(), EngineOptions(), message);
+    ASSERT_FALSE(decompress_with_engine(other_order, &snapshot).has_value());
+
+    // Nor a stream of another snapshot of the same order, or of none.
+    auto other_snapshot = ModelSnapshot(train_engine_snapshot(config, EngineOptions(), message));
+    ASSERT_FALSE(decompress_with_engine(compressed_data, &other_snapshot).has_value());
+    ASSERT_FALSE(decompress_with_engine(compressed_data, nullptr).has_value());
+}
+
 UTEST(PPM_Huffman, leonardo) {
     using namespace compadre;
 
@@ -273,9 +1253,13 @@ UTEST(PPM_Huffman, leonardo) {
     duracao = fim - inicio;
     std::println("Tempo de descompressao: {}s", duracao.count() / 1000.0);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    {
+        auto expected = precproc_bras_cubas.as_string();
+        auto decompressed = decompressed_text.as_string();
+        ASSERT_EQ(expected.size(), decompressed.size());
+        for (std::size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decompressed[i]);
+        }
     }
 
     // ===== K=1 =====
@@ -298,9 +1282,13 @@ UTEST(PPM_Huffman, leonardo) {
     duracao = fim - inicio;
     std::println("Tempo de descompressao: {}s", duracao.count() / 1000.0);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    {
+        auto expected = precproc_bras_cubas.as_string();
+        auto decompressed = decompressed_text.as_string();
+        ASSERT_EQ(expected.size(), decompressed.size());
+        for (std::size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decompressed[i]);
+        }
     }
 
 
@@ -325,9 +1313,13 @@ UTEST(PPM_Huffman, leonardo) {
     duracao = fim - inicio;
     std::println("Tempo de descompressao: {}s", duracao.count() / 1000.0);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    {
+        auto expected = precproc_bras_cubas.as_string();
+        auto decompressed = decompressed_text.as_string();
+        ASSERT_EQ(expected.size(), decompressed.size());
+        for (std::size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decompressed[i]);
+        }
     }
 
 
@@ -352,9 +1344,13 @@ UTEST(PPM_Huffman, leonardo) {
     duracao = fim - inicio;
     std::println("Tempo de descompressao: {}s", duracao.count() / 1000.0);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    {
+        auto expected = precproc_bras_cubas.as_string();
+        auto decompressed = decompressed_text.as_string();
+        ASSERT_EQ(expected.size(), decompressed.size());
+        for (std::size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decompressed[i]);
+        }
     }
 
 
@@ -380,9 +1376,13 @@ UTEST(PPM_Huffman, leonardo) {
     duracao = fim - inicio;
     std::println("Tempo de descompressao: {}s", duracao.count() / 1000.0);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    {
+        auto expected = precproc_bras_cubas.as_string();
+        auto decompressed = decompressed_text.as_string();
+        ASSERT_EQ(expected.size(), decompressed.size());
+        for (std::size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decompressed[i]);
+        }
     }
 
     // ===== K=5 =====
@@ -405,9 +1405,13 @@ UTEST(PPM_Huffman, leonardo) {
     duracao = fim - inicio;
     std::println("Tempo de descompressao: {}s", duracao.count() / 1000.0);
 
-    ASSERT_EQ(precproc_bras_cubas.as_string().size(), decompressed_text.as_string().size());
-    for (std::size_t i = 0; i < precproc_bras_cubas.as_string().size(); i++) {
-        ASSERT_EQ(precproc_bras_cubas.as_string()[i], decompressed_text.as_string()[i]);
+    {
+        auto expected = precproc_bras_cubas.as_string();
+        auto decompressed = decompressed_text.as_string();
+        ASSERT_EQ(expected.size(), decompressed.size());
+        for (std::size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decompressed[i]);
+        }
     }
 }
 